@@ -1,21 +1,250 @@
 #include <iostream>
+#include <sstream>
+#include <cassert>
 #include <array>
+#include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <charconv>
+#include <string_view>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <filesystem>
+#include <variant>
+#include <utility>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TABLE_MMAP
+#endif
+#ifndef TABLE_STATISTICS
+#define TABLE_STATISTICS 1
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define TABLE_SIMD_X86
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define TABLE_COROUTINES
+#endif
 
-enum AvailableTypes {TEXT, NUMBER, NONE};
-enum Operations {SUM, PRODUCT, AVERAGE, EMPTY};
-enum CellType {DATA, FORMULAWITHRESULT, EMPTYRESULT, VOID};
-const size_t MAXSIZE = 100;
+enum AvailableTypes : unsigned char {TEXT, NUMBER, NONE};
+enum Operations {SUM, PRODUCT, AVERAGE, MINIMUM, MAXIMUM, COUNT, VARIANCE,
+        DEVIATION, EMPTY};
+enum CellType : unsigned char {DATA, FORMULAWITHRESULT, EMPTYRESULT, VOID,
+        CYCLE};
+enum CellTag : unsigned char {BLANK, EMPTYDATA, NUMERIC, TEXTUAL, NORESULT,
+        RESULT, CIRCULAR};
+const int BLOCKSIZE = 32;
+const size_t PARALLELTILES = 16;
+const uint64_t WIDERANGE = 4096;
+const size_t CHUNKLENGTH = 256;
+const size_t SHARDCOUNT = 256;
+
+// Range kernels check that every cell holds a number and fold the values
+// into four lanes; all variants share that lane order, so SUM/PRODUCT
+// results do not depend on which one the CPU dispatch picks.
+using AggregateKernel = bool (*)(const double*, const CellTag*, int,
+        double&, double&);
+bool aggregateScalar(const double* number, const CellTag* tag, int count,
+                     double& sum, double& product);
+#ifdef TABLE_SIMD_X86
+bool aggregateSse2(const double* number, const CellTag* tag, int count,
+                   double& sum, double& product);
+bool aggregateAvx2(const double* number, const CellTag* tag, int count,
+                   double& sum, double& product);
+#endif
+AggregateKernel selectKernel();
+bool summable(CellTag tag);
+template <typename T>
+T& own(std::shared_ptr<T>& shared);
+
+// Elements live in chunks of CHUNKLENGTH that copies share; a write
+// through edit() or push_back() copies only the chunk it lands in.
+template <typename T>
+class SharedChunks {
+public:
+    [[nodiscard]] const T& operator[](size_t index) const;
+    T& edit(size_t index);
+    void push_back(T value);
+    void pop_back();
+    [[nodiscard]] const T& back() const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool empty() const;
+private:
+    std::vector<std::shared_ptr<std::vector<T>>> chunks;
+    size_t count = 0;
+};
+
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads);
+    WorkerPool(const WorkerPool&) = delete;
+    ~WorkerPool();
+    void run(size_t tasks, const std::function<void(size_t)>& job);
+private:
+    void work();
+    std::vector<std::thread> workers;
+    std::mutex running;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* current = nullptr;
+    std::atomic<size_t> next{0};
+    size_t total = 0;
+    size_t active = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
+
+class CsvReader {
+public:
+    explicit CsvReader(std::istream& input);
+    bool next(std::string_view& field, bool& quoted, bool& last);
+    [[nodiscard]] bool failed() const;
+private:
+    bool fill();
+    static const size_t CHUNKSIZE = 1 << 16;
+    std::istream& input;
+    std::string buffer;
+    std::string unescaped;
+    size_t position = 0;
+    bool carriage = false;
+    bool broken = false;
+};
+
+class Journal {
+public:
+    Journal(std::FILE* file, std::string path);
+    Journal(const Journal&) = delete;
+    ~Journal();
+    void append(std::string_view record);
+    bool sync();
+    bool reset();
+    [[nodiscard]] const std::string& path() const;
+private:
+    void work();
+    std::FILE* file;
+    std::string location;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable durable;
+    std::string pending;
+    uint64_t appended = 0;
+    uint64_t synced = 0;
+    bool stopping = false;
+    bool failed = false;
+};
+
+uint32_t journalChecksum(std::string_view payload);
+
+class Table;
+
+// Holds the latest published version. Readers take a fixed number of
+// atomic steps; the writer retires the previous holder only after two
+// epoch flips have drained every reader that could still be copying it.
+class VersionSlot {
+public:
+    VersionSlot() = default;
+    VersionSlot(const VersionSlot&) = delete;
+    ~VersionSlot();
+    void store(std::shared_ptr<const Table> version);
+    [[nodiscard]] std::shared_ptr<const Table> load() const;
+private:
+    std::atomic<const std::shared_ptr<const Table>*> current{nullptr};
+    std::atomic<unsigned> epoch{0};
+    mutable std::atomic<size_t> readers[2]{};
+    std::mutex writing;
+};
+
+// Copies share the entry chunks and lookup shards, so a copied pool is
+// cheap and a write copies one chunk and one shard. Texts sit behind their
+// own pointers, which keeps the views a shared shard holds valid.
+class StringPool {
+public:
+    StringPool();
+    uint32_t intern(std::string_view text);
+    uint32_t adopt(std::string&& text);
+    void release(uint32_t handle);
+    [[nodiscard]] std::string_view view(uint32_t handle) const;
+    [[nodiscard]] size_t size() const;
+private:
+    using Lookup = std::unordered_map<std::string_view, uint32_t>;
+    struct Entry {
+        std::shared_ptr<const std::string> text;
+        uint32_t references = 0;
+    };
+    SharedChunks<Entry> entries;
+    std::array<std::shared_ptr<Lookup>, SHARDCOUNT> lookup;
+    SharedChunks<uint32_t> released;
+    size_t distinct = 0;
+    [[nodiscard]] uint32_t find(std::string_view text) const;
+    uint32_t insert(std::string&& text);
+    static size_t shardOf(std::string_view text);
+};
+
+// Filled by every recalculation when TABLE_STATISTICS is non-zero; with
+// -DTABLE_STATISTICS=0 the timers compile out and everything stays zero.
+// A fused same-range group's time is split evenly across its formulas.
+struct RecalcStatistics {
+    struct Costly {
+        int row;
+        int column;
+        char operation;
+        uint64_t cells;
+        double microseconds;
+    };
+    static const size_t COSTLIEST = 8;
+    uint64_t recalculations = 0;
+    uint64_t formulas = 0;
+    uint64_t cells = 0;
+    double microseconds = 0.;
+    uint64_t lastFormulas = 0;
+    uint64_t lastCells = 0;
+    double lastMicroseconds = 0.;
+    std::map<char, uint64_t> operationCount;
+    std::map<char, double> operationMicroseconds;
+    std::vector<Costly> costliest;
+    void dump(std::ostream& output) const;
+};
 
 class TableCell{
 public:
     TableCell();
     explicit TableCell(std::string& value);
+    explicit TableCell(std::string&& value);
     explicit TableCell(double value);
     TableCell(const TableCell& copy);
+    TableCell(TableCell&& move) noexcept;
     ~TableCell() = default;
+    TableCell& operator=(const TableCell& copy) = default;
+    TableCell& operator=(TableCell&& move) noexcept = default;
     virtual void print() const;
     [[nodiscard]] double getNumberData() const;
-    [[nodiscard]] std::string getTextData() const;
+    [[nodiscard]] std::string getTextData() const&;
+    [[nodiscard]] std::string getTextData() &&;
+    [[nodiscard]] std::string_view getTextView() const;
     [[nodiscard]] char getDataType() const;
     void update(std::string& new_value);
     void update(double new_value);
@@ -32,7 +261,11 @@ public:
     CellWithFormula(const std::pair<int, int>& start_cell, const std::pair<int,
             int>& end_cell, char type);
     CellWithFormula(const CellWithFormula& copy);
+    CellWithFormula(CellWithFormula&& move) noexcept;
     explicit CellWithFormula(const TableCell& copy);
+    explicit CellWithFormula(TableCell&& move);
+    CellWithFormula& operator=(const CellWithFormula& copy) = default;
+    CellWithFormula& operator=(CellWithFormula&& move) noexcept = default;
     void print() const override;
     [[nodiscard]] std::pair<int, int> getStartCell() const;
     [[nodiscard]] std::pair<int, int> getEndCell() const;
@@ -53,334 +286,2812 @@ public:
     Table(int row, int column, const TableCell& cell);
     Table(int row, int column, const CellWithFormula& cell);
     Table(const Table& copy);
+    Table(Table&& move) noexcept;
+    Table& operator=(const Table& copy);
+    Table& operator=(Table&& move) noexcept;
+    bool replaceWith(const Table& other);
     void print(int row, int column) const;
     void update(int row, int column, const TableCell& cell);
     void update(int row, int column, const CellWithFormula& cell);
+    void update(int row, int column, TableCell&& cell);
+    void update(int row, int column, CellWithFormula&& cell);
     [[nodiscard]] double getCellData(int row, int column) const;
     [[nodiscard]] char getCellType(int row, int column) const;
+    [[nodiscard]] std::string_view getCellText(int row, int column) const;
     [[nodiscard]] std::string cellType() const override;
+    void update(const std::vector<std::pair<std::pair<int, int>,
+            TableCell>>& cells);
+    void beginBatch();
+    void commitBatch();
+    bool publish();
+    [[nodiscard]] std::shared_ptr<const Table> snapshot() const;
+    void setPrefixIndex(bool enabled);
+    void setThreads(unsigned count);
+    void setLazy(bool enabled);
+    void setRangeCache(bool enabled);
+    [[nodiscard]] size_t cacheHits() const;
+    [[nodiscard]] size_t cacheMisses() const;
+    [[nodiscard]] const RecalcStatistics& statistics() const;
+    void resetStatistics();
+    bool openJournal(const std::string& path, size_t interval = 0);
+    bool syncJournal();
+    bool checkpoint();
+    [[nodiscard]] bool save(const std::string& path) const;
+    bool load(const std::string& path);
+    bool importCsv(std::istream& input, int row = 0, int column = 0);
+    void exportCsv(std::ostream& output) const;
+private:
+    using Range = std::pair<std::pair<int, int>, std::pair<int, int>>;
+    void check(int row, int column);
+    void check(const std::set<std::pair<int, int>>& cells);
+    void evaluateLevels(std::map<std::pair<int, int>, int>& degree,
+                        std::map<std::pair<int, int>,
+                        std::vector<std::pair<int, int>>>& edges) const;
+    uint64_t evaluate(const std::vector<std::pair<int, int>>& cells,
+                      bool split) const;
+    void record(const std::vector<std::pair<int, int>>& cells,
+                uint64_t scanned, double microseconds) const;
+    void prepare(int row, int column) const;
+    void invalidate(const std::set<std::pair<int, int>>& cells);
+    [[nodiscard]] std::vector<std::pair<int, int>> staleInputs(
+            const std::set<std::pair<int, int>>& cells, int row,
+            int column) const;
+    void resolve(int row, int column) const;
+    void refresh(const std::set<std::pair<int, int>>& cells) const;
+    [[nodiscard]] bool isFormula(int row, int column) const;
+    [[nodiscard]] std::vector<std::pair<int, int>> dependentsOf(int row,
+            int column) const;
+    void attach(int row, int column);
+    void detach(int row, int column);
+    template <typename Visit>
+    void coveringRanges(int row, int column, Visit&& visit) const;
+    void forget(int row, int column) const;
+    void forget(const Range& range) const;
+    bool recall(const std::vector<std::pair<int, int>>& cells) const;
+    void remember(const std::vector<std::pair<int, int>>& cells) const;
+    struct Block {
+        std::array<std::array<double, BLOCKSIZE>, BLOCKSIZE> number{};
+        std::array<std::array<uint32_t, BLOCKSIZE>, BLOCKSIZE> payload{};
+        std::array<std::array<CellTag, BLOCKSIZE>, BLOCKSIZE> tag{};
+        std::vector<double> prefixSum;
+        std::vector<int> prefixInvalid;
+        bool prefixDirty = true;
+    };
+    struct SnapshotHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t blockSize;
+        uint32_t reserved;
+        uint64_t blocks;
+        uint64_t texts;
+        uint64_t formulas;
+        uint64_t heapSize;
+    };
+    struct TextEntry {
+        int32_t row;
+        int32_t column;
+        uint32_t offset;
+        uint32_t length;
+    };
+    struct FormulaEntry {
+        int32_t row;
+        int32_t column;
+        int32_t startRow;
+        int32_t startColumn;
+        int32_t endRow;
+        int32_t endColumn;
+        int32_t operation;
+        int32_t reserved;
+    };
+    bool restore(const char* image, size_t size);
+    struct Formula {
+        std::pair<int, int> start;
+        std::pair<int, int> end;
+        char operation;
+    };
+    [[nodiscard]] static bool wellFormed(const Formula& formula);
+    struct Cached {
+        CellType state;
+        double value;
+    };
+    using Dependents = std::map<Range, std::set<std::pair<int, int>>>;
+    using Cache = std::map<std::pair<Range, char>, Cached>;
+    // Copies of a Table share one Sheet, and sheets share their blocks,
+    // chunks, buckets and shards until a write goes through unshare() and
+    // then own() or blockAt(); a copied sheet holds only pointers to them.
+    // Dependents and cache entries are sharded by shardOf(range).
+    struct Sheet {
+        std::map<std::pair<int, int>, std::shared_ptr<Block>> blocks;
+        SharedChunks<Formula> formulas;
+        SharedChunks<uint32_t> releasedFormulas;
+        StringPool strings;
+        std::array<std::shared_ptr<Dependents>, SHARDCOUNT> dependents;
+        std::map<std::pair<int, int>, std::shared_ptr<std::set<Range>>>
+                coverage;
+        std::shared_ptr<std::set<Range>> wide;
+        std::array<std::shared_ptr<Cache>, SHARDCOUNT> cache;
+        size_t cached = 0;
+    };
+    [[nodiscard]] static size_t shardOf(const Range& range);
+    static void link(Sheet& data, const Range& range,
+                     const std::pair<int, int>& cell);
+    static bool unlink(Sheet& data, const Range& range,
+                       const std::pair<int, int>& cell);
+    template <typename Visit>
+    static void eachBlock(const Range& range, Visit&& visit);
+    struct Partial {
+        double sum = 0.;
+        double product = 1.;
+        double minimum = std::numeric_limits<double>::infinity();
+        double maximum = -std::numeric_limits<double>::infinity();
+        double deviation = 0.;
+        long long count = 0;
+        bool circular = false;
+        CellType state = FORMULAWITHRESULT;
+    };
+    [[nodiscard]] Partial aggregateTile(int bx, int by, int l_1, int r_1,
+                                        int l_2, int r_2, bool moments,
+                                        bool counting) const;
+    static void merge(Partial& total, const Partial& part);
+    static void buildPrefix(Block& block);
+    bool prefixRangeSum(int l_1, int r_1, int l_2, int r_2,
+                        double& result) const;
+    [[nodiscard]] const Block* findBlock(int row, int column) const;
+    Sheet& unshare() const;
+    Block& blockAt(int row, int column) const;
+    [[nodiscard]] CellTag tagAt(int row, int column) const;
+    [[nodiscard]] CellType typeAt(int row, int column) const;
+    [[nodiscard]] AvailableTypes kindAt(int row, int column) const;
+    [[nodiscard]] double numberAt(int row, int column) const;
+    [[nodiscard]] std::string_view textAt(int row, int column) const;
+    [[nodiscard]] const Formula& formulaAt(int row, int column) const;
+    void release(Block& block, int x, int y);
+    void set(int row, int column, const TableCell& cell);
+    void set(int row, int column, double number, AvailableTypes kind,
+             uint32_t handle);
+    void importField(int row, int column, std::string_view field,
+                     bool quoted);
+    void set(int row, int column, const CellWithFormula& cell);
+    void log(char kind, int row, int column, std::string_view payload);
+    bool replay(const std::string& path, uint64_t& valid);
+    void checkpointIfDue();
+    void setState(int row, int column, CellType state) const;
+    void setResult(int row, int column, double result) const;
+    mutable std::shared_ptr<Sheet> sheet = std::make_shared<Sheet>();
+    bool prefixIndex = false;
+    int batchDepth = 0;
+    std::set<std::pair<int, int>> dirty;
+    bool lazy = false;
+    mutable std::set<std::pair<int, int>> stale;
+    std::shared_ptr<WorkerPool> pool;
+    VersionSlot published;
+    bool rangeCache = false;
+    mutable size_t hits = 0;
+    mutable size_t misses = 0;
+    mutable RecalcStatistics counters;
+    std::unique_ptr<Journal> journal;
+    size_t checkpointInterval = 0;
+    size_t journalRecords = 0;
+};
+
+struct Workload {
+    int rows = 2048;
+    int columns = 64;
+    double formulas = 0.001;
+    int height = 256;
+    int width = 8;
+    double overlap = 0.5;
+    double reads = 0.9;
+    int operations = 2000;
+    unsigned threads = 1;
+    unsigned seed = 1;
+};
+
+bool parseWorkload(int argc, char* argv[], Workload& workload);
+void report(std::ostream& output, const char* name,
+            std::vector<double>& samples);
+long peakResidentKilobytes();
+void compareLayouts(const Workload& workload, std::ostream& output);
+void benchmark(const Workload& workload, std::ostream& output);
+
+#ifdef TABLE_COROUTINES
+// Fire-and-forget coroutine for request handlers that co_await the
+// pipeline; it runs eagerly and frees its frame when it finishes.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Takes over the table for its lifetime: writes are queued and applied by a
+// background stage, reads resume once every earlier write is visible.
+class UpdatePipeline {
+public:
+    class Read;
+    explicit UpdatePipeline(Table& table);
+    UpdatePipeline(const UpdatePipeline&) = delete;
+    ~UpdatePipeline();
+    uint64_t update(int row, int column, TableCell cell);
+    uint64_t update(int row, int column, CellWithFormula cell);
+    [[nodiscard]] Read read(int row, int column);
+    [[nodiscard]] uint64_t coalesced();
+private:
+    using Pending = std::variant<TableCell, CellWithFormula>;
+    uint64_t enqueue(int row, int column, Pending&& cell);
+    void work();
+    Table& table;
+    std::thread stage;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::map<std::pair<int, int>, Pending> pending;
+    std::vector<std::pair<uint64_t, std::coroutine_handle<>>> waiters;
+    uint64_t queued = 0;
+    std::atomic<uint64_t> applied{0};
+    uint64_t merged = 0;
+    bool stopping = false;
+};
+
+class UpdatePipeline::Read {
+public:
+    [[nodiscard]] bool await_ready() const noexcept;
+    bool await_suspend(std::coroutine_handle<> handle);
+    [[nodiscard]] double await_resume() const;
 private:
-    void check();
-    std::array<std::array<CellWithFormula, MAXSIZE>, MAXSIZE> data{};
-    std::array<std::array<CellType, MAXSIZE>, MAXSIZE> type{};
+    friend class UpdatePipeline;
+    Read(UpdatePipeline& pipeline, int row, int column, uint64_t target);
+    UpdatePipeline& pipeline;
+    int row;
+    int column;
+    uint64_t target;
 };
+#endif
+
+WorkerPool::WorkerPool(unsigned threads) {
+    for (unsigned k = 0; k < threads; ++k)
+        workers.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void WorkerPool::run(size_t tasks, const std::function<void(size_t)>& job) {
+    std::lock_guard<std::mutex> exclusive(running);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &job;
+        total = tasks;
+        next = 0;
+        active = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+    for (size_t k; (k = next++) < tasks;)
+        job(k);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return !active; });
+}
+
+void WorkerPool::work() {
+    unsigned seen = 0;
+    for (;;) {
+        const std::function<void(size_t)>* job;
+        size_t tasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            job = current;
+            tasks = total;
+        }
+        for (size_t k; (k = next++) < tasks;)
+            (*job)(k);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!--active)
+            done.notify_all();
+    }
+}
+
+CsvReader::CsvReader(std::istream& input): input(input) {}
+
+bool CsvReader::fill() {
+    buffer.erase(0, position);
+    position = 0;
+    size_t size = buffer.size();
+    buffer.resize(size + CHUNKSIZE);
+    input.read(&buffer[size], CHUNKSIZE);
+    buffer.resize(size + static_cast<size_t>(input.gcount()));
+    return buffer.size() > size;
+}
+
+bool CsvReader::next(std::string_view& field, bool& quoted, bool& last) {
+    if (position == buffer.size() && !fill())
+        return false;
+    if (carriage) {
+        carriage = false;
+        if (buffer[position] == '\n' && ++position == buffer.size() &&
+            !fill())
+            return false;
+    }
+    // A read that exactly fills the chunk leaves eof() unset, so a refill
+    // that brings nothing gets one more pass with the end of input known.
+    // Each pass resumes at scanned, the offset from the field's start that
+    // is already known not to end it, so every byte is examined once.
+    bool drained = false, escaped = false;
+    quoted = buffer[position] == '"';
+    size_t scanned = quoted ? 1 : 0;
+    for (;;) {
+        size_t end = position + scanned;
+        bool complete = false;
+        if (quoted) {
+            for (; end < buffer.size(); ++end) {
+                if (buffer[end] != '"')
+                    continue;
+                if (end + 1 == buffer.size() && !input.eof())
+                    break;
+                if (end + 1 < buffer.size() && buffer[end + 1] == '"') {
+                    escaped = true;
+                    ++end;
+                    continue;
+                }
+                complete = true;
+                ++end;
+                break;
+            }
+        }
+        else {
+            while (end < buffer.size() && buffer[end] != ',' &&
+                   buffer[end] != '\n' && buffer[end] != '\r')
+                ++end;
+            complete = end < buffer.size() || input.eof();
+        }
+        scanned = end - position;
+        if (!complete && (fill() || !std::exchange(drained, true)))
+            continue;
+        if (!complete && quoted) {
+            broken = true;
+            return false;
+        }
+        field = std::string_view(buffer).substr(position, end - position);
+        if (quoted) {
+            field = field.substr(1, field.size() - 2);
+            if (escaped) {
+                unescaped.clear();
+                for (size_t k = 0; k < field.size(); ++k) {
+                    unescaped += field[k];
+                    if (field[k] == '"')
+                        ++k;
+                }
+                field = unescaped;
+            }
+        }
+        last = end == buffer.size() || buffer[end] != ',';
+        carriage = end < buffer.size() && buffer[end] == '\r';
+        position = end < buffer.size() ? end + 1 : end;
+        return true;
+    }
+}
+
+bool CsvReader::failed() const {
+    return broken;
+}
+
+Journal::Journal(std::FILE* file, std::string path): file(file),
+location(std::move(path)) {
+    writer = std::thread(&Journal::work, this);
+}
+
+Journal::~Journal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    if (file)
+        std::fclose(file);
+}
+
+void Journal::append(std::string_view record) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.append(record.data(), record.size());
+        appended += record.size();
+    }
+    wake.notify_one();
+}
+
+// Records appended while the writer is inside fsync pile up in pending and
+// go out together on its next pass, one fsync per group.
+void Journal::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+            return;
+        std::string group;
+        group.swap(pending);
+        uint64_t target = appended;
+        std::FILE* output = file;
+        lock.unlock();
+        bool written = output && std::fwrite(group.data(), 1, group.size(),
+                                             output) == group.size() &&
+                       !std::fflush(output);
+#ifdef TABLE_MMAP
+        written = written && !fsync(fileno(output));
+#endif
+        lock.lock();
+        failed = failed || !written;
+        synced = target;
+        durable.notify_all();
+    }
+}
+
+bool Journal::sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t target = appended;
+    durable.wait(lock, [&] { return synced >= target; });
+    return !failed;
+}
+
+// The table is the only appender and nothing is appended while it resets,
+// so once sync() returns the writer is idle and file can be reopened.
+bool Journal::reset() {
+    if (!sync())
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    file = std::freopen(location.c_str(), "wb", file);
+    failed = !file;
+    if (failed)
+        return false;
+#ifdef TABLE_MMAP
+    failed = fsync(fileno(file)) != 0;
+#endif
+    return !failed;
+}
+
+const std::string& Journal::path() const {
+    return location;
+}
+
+VersionSlot::~VersionSlot() {
+    delete current.load();
+}
+
+std::shared_ptr<const Table> VersionSlot::load() const {
+    unsigned phase = epoch.load() & 1;
+    ++readers[phase];
+    const std::shared_ptr<const Table>* holder = current.load();
+    std::shared_ptr<const Table> version = holder ? *holder : nullptr;
+    --readers[phase];
+    return version;
+}
+
+// A reader registers under the phase it read, which may already be stale,
+// so draining only the phase just left is not enough; once both phases
+// have drained no reader can still hold the retired holder's address.
+void VersionSlot::store(std::shared_ptr<const Table> version) {
+    std::lock_guard<std::mutex> lock(writing);
+    const std::shared_ptr<const Table>* retired = current.exchange(
+            new std::shared_ptr<const Table>(std::move(version)));
+    for (int k = 0; k < 2; ++k) {
+        unsigned phase = epoch++ & 1;
+        while (readers[phase])
+            std::this_thread::yield();
+    }
+    delete retired;
+}
+
+// A use count of one may have been reached by another thread dropping its
+// copy; the acquire fence orders that thread's last reads before the
+// in-place writes that follow.
+template <typename T>
+T& own(std::shared_ptr<T>& shared) {
+    if (!shared)
+        shared = std::make_shared<T>();
+    else if (shared.use_count() > 1)
+        shared = std::make_shared<T>(*shared);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return *shared;
+}
+
+template <typename T>
+const T& SharedChunks<T>::operator[](size_t index) const {
+    return (*chunks[index / CHUNKLENGTH])[index % CHUNKLENGTH];
+}
+
+template <typename T>
+T& SharedChunks<T>::edit(size_t index) {
+    return own(chunks[index / CHUNKLENGTH])[index % CHUNKLENGTH];
+}
+
+template <typename T>
+void SharedChunks<T>::push_back(T value) {
+    if (count % CHUNKLENGTH == 0) {
+        chunks.emplace_back(std::make_shared<std::vector<T>>());
+        chunks.back()->reserve(CHUNKLENGTH);
+    }
+    own(chunks.back()).push_back(std::move(value));
+    ++count;
+}
+
+template <typename T>
+void SharedChunks<T>::pop_back() {
+    if (--count % CHUNKLENGTH == 0)
+        chunks.pop_back();
+    else
+        own(chunks.back()).pop_back();
+}
+
+template <typename T>
+const T& SharedChunks<T>::back() const {
+    return (*this)[count - 1];
+}
+
+template <typename T>
+size_t SharedChunks<T>::size() const {
+    return count;
+}
+
+template <typename T>
+bool SharedChunks<T>::empty() const {
+    return !count;
+}
+
+StringPool::StringPool() {
+    entries.push_back({});
+}
+
+uint32_t StringPool::intern(std::string_view text) {
+    uint32_t handle = find(text);
+    if (handle) {
+        ++entries.edit(handle).references;
+        return handle;
+    }
+    return insert(std::string(text));
+}
+
+uint32_t StringPool::adopt(std::string&& text) {
+    uint32_t handle = find(text);
+    if (handle) {
+        ++entries.edit(handle).references;
+        return handle;
+    }
+    return insert(std::move(text));
+}
+
+uint32_t StringPool::find(std::string_view text) const {
+    const std::shared_ptr<Lookup>& shard = lookup[shardOf(text)];
+    if (!shard)
+        return 0;
+    auto found = shard->find(text);
+    return found == shard->end() ? 0 : found->second;
+}
+
+uint32_t StringPool::insert(std::string&& text) {
+    uint32_t handle;
+    if (released.empty()) {
+        handle = static_cast<uint32_t>(entries.size());
+        entries.push_back({});
+    }
+    else {
+        handle = released.back();
+        released.pop_back();
+    }
+    Entry& entry = entries.edit(handle);
+    entry.text = std::make_shared<const std::string>(std::move(text));
+    entry.references = 1;
+    own(lookup[shardOf(*entry.text)]).emplace(*entry.text, handle);
+    ++distinct;
+    return handle;
+}
+
+void StringPool::release(uint32_t handle) {
+    if (!handle)
+        return;
+    Entry& entry = entries.edit(handle);
+    if (--entry.references)
+        return;
+    own(lookup[shardOf(*entry.text)]).erase(*entry.text);
+    entry.text.reset();
+    released.push_back(handle);
+    --distinct;
+}
+
+std::string_view StringPool::view(uint32_t handle) const {
+    const std::shared_ptr<const std::string>& text = entries[handle].text;
+    return text ? std::string_view(*text) : std::string_view();
+}
+
+size_t StringPool::size() const {
+    return distinct;
+}
+
+size_t StringPool::shardOf(std::string_view text) {
+    return std::hash<std::string_view>()(text) % SHARDCOUNT;
+}
+
+TableCell::TableCell() {
+    dataText = "";
+    dataNumber = 0.0;
+    type = NONE;
+}
+
+TableCell::TableCell(std::string& value) {
+    dataText = value;
+    dataNumber = 0.;
+    type = TEXT;
+}
+
+TableCell::TableCell(std::string&& value): dataText(std::move(value)) {
+    dataNumber = 0.;
+    type = TEXT;
+}
+
+TableCell::TableCell(double value) {
+    dataText = "";
+    dataNumber = value;
+    type = NUMBER;
+}
+
+TableCell::TableCell(const TableCell& copy) {
+    dataText = copy.dataText;
+    dataNumber = copy.dataNumber;
+    type = copy.type;
+}
+
+TableCell::TableCell(TableCell&& move) noexcept:
+dataText(std::move(move.dataText)) {
+    dataNumber = move.dataNumber;
+    type = move.type;
+}
+
+void TableCell::print() const {
+    if (type == TEXT) {
+        std::cout << "Data: " << dataText << '\n';
+        return;
+    }
+    if (type == NUMBER) {
+        std::cout << "Data: " << dataNumber << '\n';
+    }
+}
+
+double TableCell::getNumberData() const {
+    return dataNumber;
+}
+
+std::string TableCell::getTextData() const& {
+    return dataText;
+}
+
+std::string TableCell::getTextData() && {
+    return std::move(dataText);
+}
+
+std::string_view TableCell::getTextView() const {
+    return dataText;
+}
+
+char TableCell::getDataType() const {
+    switch (type) {
+        case NUMBER: return '0';
+        case TEXT: return 's';
+        case NONE: return 'E';
+    }
+}
+
+void TableCell::update(std::string& new_value) {
+    dataText = new_value;
+    dataNumber = 0;
+    type = TEXT;
+}
+
+void TableCell::update(double new_value) {
+    dataText = "";
+    dataNumber = new_value;
+    type = NUMBER;
+}
+
+std::string TableCell::cellType() const {
+    std::string typeOfCell = "Data cell";
+    return typeOfCell;
+}
+
+CellWithFormula::CellWithFormula() : TableCell() {
+    std::pair<int, int> temp{0, 0};
+    start = temp;
+    end = temp;
+    result = 0.;
+    operation = EMPTY;
+}
+
+CellWithFormula::CellWithFormula(const std::pair<int, int>& start_cell,
+                                 const std::pair<int, int>& end_cell,
+                                 char type): TableCell() {
+    start = start_cell;
+    end = end_cell;
+    result = 0.;
+    switch (type) {
+        case '+': operation = SUM;
+            break;
+        case '*': operation = PRODUCT;
+            break;
+        case '~': operation = AVERAGE;
+            break;
+        case '<': operation = MINIMUM;
+            break;
+        case '>': operation = MAXIMUM;
+            break;
+        case '#': operation = COUNT;
+            break;
+        case '^': operation = VARIANCE;
+            break;
+        case '|': operation = DEVIATION;
+            break;
+        default: operation = EMPTY;
+    }
+}
+
+CellWithFormula::CellWithFormula(const CellWithFormula &copy)  :
+TableCell(copy) {
+    start = copy.start;
+    end = copy.end;
+    result = copy.result;
+    operation = copy.operation;
+}
+
+CellWithFormula::CellWithFormula(CellWithFormula&& move) noexcept:
+TableCell(std::move(move)) {
+    start = move.start;
+    end = move.end;
+    result = move.result;
+    operation = move.operation;
+}
+
+CellWithFormula::CellWithFormula(const TableCell& copy): TableCell(copy) {
+    operation = EMPTY;
+}
+
+CellWithFormula::CellWithFormula(TableCell&& move):
+TableCell(std::move(move)) {
+    operation = EMPTY;
+}
+
+void CellWithFormula::print() const {
+    if (operation == EMPTY) {
+        std::cout << "No formula is found\n";
+        return;
+    }
+    std::cout << "Result: " << result << '\n';
+}
+
+std::pair<int, int> CellWithFormula::getStartCell() const {
+    return start;
+}
+
+std::pair<int, int> CellWithFormula::getEndCell() const {
+    return end;
+}
+
+char CellWithFormula::getOperationType() const {
+    switch (operation) {
+        case SUM: return '+';
+        case PRODUCT: return '*';
+        case AVERAGE: return '~';
+        case MINIMUM: return '<';
+        case MAXIMUM: return '>';
+        case COUNT: return '#';
+        case VARIANCE: return '^';
+        case DEVIATION: return '|';
+        case EMPTY: return '?';
+    }
+}
+
+void CellWithFormula::update(const std::pair<int, int>& start_cell,
+                             const std::pair<int, int>& end_cell, char type) {
+    start = start_cell;
+    end = end_cell;
+    switch (type) {
+        case '+': operation = SUM;
+            break;
+        case '*': operation = PRODUCT;
+            break;
+        case '~': operation = AVERAGE;
+            break;
+        case '<': operation = MINIMUM;
+            break;
+        case '>': operation = MAXIMUM;
+            break;
+        case '#': operation = COUNT;
+            break;
+        case '^': operation = VARIANCE;
+            break;
+        case '|': operation = DEVIATION;
+            break;
+        default: operation = EMPTY;
+    }
+}
+
+std::string CellWithFormula::cellType() const {
+    std::string typeOfCell = "Formula cell";
+    return typeOfCell;
+}
+
+Table::Table(): CellWithFormula() {}
+
+Table::Table(int row, int column, const TableCell &cell):
+CellWithFormula(cell) {
+    set(row, column, cell);
+}
+
+Table::Table(int row, int column, const CellWithFormula &cell) :
+CellWithFormula(cell) {
+    set(row, column, cell);
+    attach(row, column);
+}
+
+Table::Table(const Table &copy): CellWithFormula(copy) {
+    sheet = copy.sheet;
+    prefixIndex = copy.prefixIndex;
+    batchDepth = copy.batchDepth;
+    dirty = copy.dirty;
+    pool = copy.pool;
+    lazy = copy.lazy;
+    stale = copy.stale;
+    rangeCache = copy.rangeCache;
+    hits = copy.hits;
+    misses = copy.misses;
+    counters = copy.counters;
+}
+
+Table::Table(Table&& move) noexcept: CellWithFormula(std::move(move)) {
+    sheet.swap(move.sheet);
+    prefixIndex = move.prefixIndex;
+    batchDepth = move.batchDepth;
+    dirty.swap(move.dirty);
+    pool.swap(move.pool);
+    lazy = move.lazy;
+    stale.swap(move.stale);
+    rangeCache = move.rangeCache;
+    hits = move.hits;
+    misses = move.misses;
+    counters = std::move(move.counters);
+    journal = std::move(move.journal);
+    checkpointInterval = move.checkpointInterval;
+    journalRecords = move.journalRecords;
+}
+
+// Assignment does no file I/O, so it leaves a journaled table untouched;
+// such a table takes new contents through replaceWith(), which reports
+// whether the checkpoint that makes them durable succeeded.
+Table& Table::operator=(const Table& copy) {
+    if (this != &copy && !journal)
+        *this = Table(copy);
+    return *this;
+}
+
+// Moves only hand over handles and never reach the journal's file, which
+// is what keeps them noexcept.
+Table& Table::operator=(Table&& move) noexcept {
+    if (this != &move && !journal) {
+        CellWithFormula::operator=(std::move(move));
+        sheet.swap(move.sheet);
+        prefixIndex = move.prefixIndex;
+        batchDepth = move.batchDepth;
+        dirty.swap(move.dirty);
+        pool.swap(move.pool);
+        lazy = move.lazy;
+        stale.swap(move.stale);
+        rangeCache = move.rangeCache;
+        hits = move.hits;
+        misses = move.misses;
+        counters = std::move(move.counters);
+        journal = std::move(move.journal);
+        checkpointInterval = move.checkpointInterval;
+        journalRecords = move.journalRecords;
+    }
+    return *this;
+}
+
+bool Table::replaceWith(const Table& other) {
+    if (this == &other)
+        return true;
+    if (!journal) {
+        *this = other;
+        return true;
+    }
+    if (batchDepth || other.batchDepth)
+        return false;
+    Table previous(*this);
+    std::unique_ptr<Journal> kept = std::move(journal);
+    size_t interval = checkpointInterval;
+    *this = other;
+    journal = std::move(kept);
+    checkpointInterval = interval;
+    if (checkpoint())
+        return true;
+    kept = std::move(journal);
+    *this = std::move(previous);
+    journal = std::move(kept);
+    checkpointInterval = interval;
+    return false;
+}
+
+const Table::Block* Table::findBlock(int row, int column) const {
+    auto block = sheet->blocks.find({row / BLOCKSIZE, column / BLOCKSIZE});
+    if (block == sheet->blocks.end())
+        return nullptr;
+    return block->second.get();
+}
+
+// A use count of one may have been reached by a reader thread dropping its
+// snapshot; the acquire fence orders that reader's last accesses before
+// the in-place writes that follow.
+Table::Sheet& Table::unshare() const {
+    if (sheet.use_count() > 1)
+        sheet = std::make_shared<Sheet>(*sheet);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return *sheet;
+}
+
+Table::Block& Table::blockAt(int row, int column) const {
+    std::pair<int, int> key{row / BLOCKSIZE, column / BLOCKSIZE};
+    auto found = sheet->blocks.find(key);
+    if (sheet.use_count() == 1 && found != sheet->blocks.end() &&
+        found->second.use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return *found->second;
+    }
+    return own(unshare().blocks[key]);
+}
+
+CellTag Table::tagAt(int row, int column) const {
+    const Block* block = findBlock(row, column);
+    if (!block)
+        return BLANK;
+    return block->tag[column % BLOCKSIZE][row % BLOCKSIZE];
+}
+
+CellType Table::typeAt(int row, int column) const {
+    switch (tagAt(row, column)) {
+        case BLANK: return VOID;
+        case RESULT: return FORMULAWITHRESULT;
+        case NORESULT: return EMPTYRESULT;
+        case CIRCULAR: return CYCLE;
+        default: return DATA;
+    }
+}
+
+AvailableTypes Table::kindAt(int row, int column) const {
+    switch (tagAt(row, column)) {
+        case NUMERIC: return NUMBER;
+        case TEXTUAL: return TEXT;
+        default: return NONE;
+    }
+}
+
+double Table::numberAt(int row, int column) const {
+    const Block* block = findBlock(row, column);
+    if (!block)
+        return 0.;
+    return block->number[column % BLOCKSIZE][row % BLOCKSIZE];
+}
+
+std::string_view Table::textAt(int row, int column) const {
+    if (tagAt(row, column) != TEXTUAL)
+        return "";
+    return sheet->strings.view(findBlock(row, column)->payload[
+            column % BLOCKSIZE][row % BLOCKSIZE]);
+}
+
+const Table::Formula& Table::formulaAt(int row, int column) const {
+    static const Formula empty{{0, 0}, {0, 0}, '?'};
+    if (!isFormula(row, column))
+        return empty;
+    return sheet->formulas[findBlock(row, column)->payload[
+            column % BLOCKSIZE][row % BLOCKSIZE]];
+}
+
+void Table::release(Block& block, int x, int y) {
+    if (block.tag[y][x] == TEXTUAL)
+        unshare().strings.release(block.payload[y][x]);
+    if (block.tag[y][x] >= NORESULT)
+        unshare().releasedFormulas.push_back(block.payload[y][x]);
+    block.payload[y][x] = 0;
+}
+
+void Table::set(int row, int column, const TableCell& cell) {
+    switch (cell.getDataType()) {
+        case '0': set(row, column, cell.getNumberData(), NUMBER, 0);
+            break;
+        case 's': set(row, column, 0., TEXT,
+                      unshare().strings.intern(cell.getTextView()));
+            break;
+        case 'E': set(row, column, 0., NONE, 0);
+    }
+}
+
+void Table::set(int row, int column, double number, AvailableTypes kind,
+                uint32_t handle) {
+    if (journal)
+        log(kind == NUMBER ? 'n' : kind == TEXT ? 's' : 'e', row, column,
+            kind == NUMBER ? std::string_view(
+                    reinterpret_cast<const char*>(&number), sizeof(number)) :
+            kind == TEXT ? sheet->strings.view(handle) : std::string_view());
+    Block& block = blockAt(row, column);
+    int x = row % BLOCKSIZE, y = column % BLOCKSIZE;
+    block.prefixDirty = true;
+    stale.erase({row, column});
+    release(block, x, y);
+    switch (kind) {
+        case NUMBER: block.tag[y][x] = NUMERIC;
+            break;
+        case TEXT: block.tag[y][x] = TEXTUAL;
+            break;
+        case NONE: block.tag[y][x] = EMPTYDATA;
+    }
+    block.number[y][x] = number;
+    block.payload[y][x] = handle;
+}
+
+void Table::set(int row, int column, const CellWithFormula& cell) {
+    Block& block = blockAt(row, column);
+    int x = row % BLOCKSIZE, y = column % BLOCKSIZE;
+    block.prefixDirty = true;
+    release(block, x, y);
+    Formula formula{cell.getStartCell(), cell.getEndCell(),
+                    cell.getOperationType()};
+    if (journal) {
+        int32_t bounds[5] = {formula.start.first, formula.start.second,
+                             formula.end.first, formula.end.second,
+                             formula.operation};
+        log('f', row, column, std::string_view(
+                reinterpret_cast<const char*>(bounds), sizeof(bounds)));
+    }
+    Sheet& data = unshare();
+    if (data.releasedFormulas.empty()) {
+        block.payload[y][x] = static_cast<uint32_t>(data.formulas.size());
+        data.formulas.push_back(formula);
+    }
+    else {
+        block.payload[y][x] = data.releasedFormulas.back();
+        data.releasedFormulas.pop_back();
+        data.formulas.edit(block.payload[y][x]) = formula;
+    }
+    block.tag[y][x] = NORESULT;
+    block.number[y][x] = cell.result;
+}
+
+void Table::setState(int row, int column, CellType state) const {
+    CellTag tag = state == FORMULAWITHRESULT ? RESULT :
+                  state == CYCLE ? CIRCULAR : NORESULT;
+    blockAt(row, column).tag[column % BLOCKSIZE][row % BLOCKSIZE] = tag;
+}
+
+void Table::setResult(int row, int column, double result) const {
+    blockAt(row, column).number[column % BLOCKSIZE][row % BLOCKSIZE] = result;
+}
+
+void Table::setThreads(unsigned count) {
+    if (count > 1)
+        pool = std::make_shared<WorkerPool>(count - 1);
+    else
+        pool.reset();
+}
+
+void Table::prepare(int row, int column) const {
+    const Formula& formula = formulaAt(row, column);
+    if (!prefixIndex || (formula.operation != '+' &&
+                         formula.operation != '~'))
+        return;
+    for (int by = formula.start.second / BLOCKSIZE;
+         by <= formula.end.second / BLOCKSIZE; ++by)
+        for (int bx = formula.start.first / BLOCKSIZE;
+             bx <= formula.end.first / BLOCKSIZE; ++bx) {
+            auto block = sheet->blocks.find({bx, by});
+            if (block == sheet->blocks.end())
+                return;
+            if (block->second->prefixDirty &&
+                block->second.use_count() == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                buildPrefix(*block->second);
+            }
+        }
+}
+
+void Table::setPrefixIndex(bool enabled) {
+    prefixIndex = enabled;
+    if (enabled)
+        return;
+    for (auto& [position, block] : sheet->blocks)
+        if (block.use_count() == 1) {
+            block->prefixDirty = true;
+            block->prefixSum = std::vector<double>();
+            block->prefixInvalid = std::vector<int>();
+        }
+}
+
+void Table::buildPrefix(Block& block) {
+    const int side = BLOCKSIZE + 1;
+    block.prefixSum.assign(side * side, 0.);
+    block.prefixInvalid.assign(side * side, 0);
+    for (int y = 0; y < BLOCKSIZE; ++y)
+        for (int x = 0; x < BLOCKSIZE; ++x) {
+            bool numeric = block.tag[y][x] == NUMERIC ||
+                           block.tag[y][x] == EMPTYDATA;
+            int at = (y + 1) * side + x + 1;
+            block.prefixSum[at] = (numeric ? block.number[y][x] : 0.) +
+                    block.prefixSum[at - 1] + block.prefixSum[at - side] -
+                    block.prefixSum[at - side - 1];
+            block.prefixInvalid[at] = !numeric +
+                    block.prefixInvalid[at - 1] +
+                    block.prefixInvalid[at - side] -
+                    block.prefixInvalid[at - side - 1];
+        }
+    block.prefixDirty = false;
+}
+
+bool Table::prefixRangeSum(int l_1, int r_1, int l_2, int r_2,
+                           double& result) const {
+    const int side = BLOCKSIZE + 1;
+    double sum = 0.;
+    for (int by = r_1 / BLOCKSIZE; by <= r_2 / BLOCKSIZE; ++by)
+        for (int bx = l_1 / BLOCKSIZE; bx <= l_2 / BLOCKSIZE; ++bx) {
+            auto found = sheet->blocks.find({bx, by});
+            if (found == sheet->blocks.end())
+                return false;
+            Block& block = *found->second;
+            if (block.prefixDirty) {
+                if (found->second.use_count() > 1)
+                    return false;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                buildPrefix(block);
+            }
+            int a = std::max(l_1, bx * BLOCKSIZE) - bx * BLOCKSIZE;
+            int b = std::min(l_2, bx * BLOCKSIZE + BLOCKSIZE - 1) -
+                    bx * BLOCKSIZE + 1;
+            int c = std::max(r_1, by * BLOCKSIZE) - by * BLOCKSIZE;
+            int d = std::min(r_2, by * BLOCKSIZE + BLOCKSIZE - 1) -
+                    by * BLOCKSIZE + 1;
+            if (block.prefixInvalid[d * side + b] -
+                block.prefixInvalid[c * side + b] -
+                block.prefixInvalid[d * side + a] +
+                block.prefixInvalid[c * side + a])
+                return false;
+            sum += block.prefixSum[d * side + b] -
+                   block.prefixSum[c * side + b] -
+                   block.prefixSum[d * side + a] +
+                   block.prefixSum[c * side + a];
+        }
+    result = sum;
+    return true;
+}
+
+void Table::print(int row, int column) const {
+    resolve(row, column);
+    if (typeAt(row, column) == DATA) {
+        switch (kindAt(row, column)) {
+            case NUMBER: std::cout << numberAt(row, column) << '\n';
+                break;
+            case TEXT: std::cout << textAt(row, column) << '\n';
+                break;
+            case NONE: std::cout << "Cell is empty\n";
+        }
+    }
+    else {
+        if (typeAt(row, column) == FORMULAWITHRESULT) {
+            switch (formulaAt(row, column).operation) {
+                case '?': std::cout << "Cell is empty\n";
+                    break;
+                default: std::cout << numberAt(row, column) << '\n';
+            }
+        }
+        else if (typeAt(row, column) == CYCLE)
+            std::cout << "Circular reference\n";
+        else
+            std::cout << "Cell is empty\n";
+    }
+}
+
+// Explicitly empty data counts as a zero, as it did before the block
+// layout; only missing cells, text and formulas without a value stop an
+// aggregate.
+bool summable(CellTag tag) {
+    return tag == NUMERIC || tag == RESULT || tag == EMPTYDATA;
+}
+
+bool aggregateScalar(const double* number, const CellTag* tag, int count,
+                     double& sum, double& product) {
+    for (int k = 0; k < count; ++k)
+        if (!summable(tag[k]))
+            return false;
+    double lane_sum[4] = {0., 0., 0., 0.}, lane_prod[4] = {1., 1., 1., 1.};
+    for (int k = 0; k < count; ++k) {
+        lane_sum[k % 4] += number[k];
+        lane_prod[k % 4] *= number[k];
+    }
+    sum += (lane_sum[0] + lane_sum[1]) + (lane_sum[2] + lane_sum[3]);
+    product *= (lane_prod[0] * lane_prod[1]) * (lane_prod[2] * lane_prod[3]);
+    return true;
+}
+
+#ifdef TABLE_SIMD_X86
+bool aggregateSse2(const double* number, const CellTag* tag, int count,
+                   double& sum, double& product) {
+    const __m128i result = _mm_set1_epi8(RESULT);
+    const __m128i numeric = _mm_set1_epi8(NUMERIC);
+    const __m128i empty = _mm_set1_epi8(EMPTYDATA);
+    int k = 0;
+    for (; k + 16 <= count; k += 16) {
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tag + k));
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(t, result),
+                                               _mm_cmpeq_epi8(t, numeric)),
+                                  _mm_cmpeq_epi8(t, empty));
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+            return false;
+    }
+    for (; k < count; ++k)
+        if (!summable(tag[k]))
+            return false;
+    __m128d sum_lo = _mm_setzero_pd(), sum_hi = _mm_setzero_pd();
+    __m128d prod_lo = _mm_set1_pd(1.), prod_hi = _mm_set1_pd(1.);
+    for (k = 0; k + 4 <= count; k += 4) {
+        __m128d lo = _mm_loadu_pd(number + k);
+        __m128d hi = _mm_loadu_pd(number + k + 2);
+        sum_lo = _mm_add_pd(sum_lo, lo);
+        sum_hi = _mm_add_pd(sum_hi, hi);
+        prod_lo = _mm_mul_pd(prod_lo, lo);
+        prod_hi = _mm_mul_pd(prod_hi, hi);
+    }
+    double lane_sum[4], lane_prod[4];
+    _mm_storeu_pd(lane_sum, sum_lo);
+    _mm_storeu_pd(lane_sum + 2, sum_hi);
+    _mm_storeu_pd(lane_prod, prod_lo);
+    _mm_storeu_pd(lane_prod + 2, prod_hi);
+    for (; k < count; ++k) {
+        lane_sum[k % 4] += number[k];
+        lane_prod[k % 4] *= number[k];
+    }
+    sum += (lane_sum[0] + lane_sum[1]) + (lane_sum[2] + lane_sum[3]);
+    product *= (lane_prod[0] * lane_prod[1]) * (lane_prod[2] * lane_prod[3]);
+    return true;
+}
+
+__attribute__((target("avx2")))
+bool aggregateAvx2(const double* number, const CellTag* tag, int count,
+                   double& sum, double& product) {
+    const __m256i result = _mm256_set1_epi8(RESULT);
+    const __m256i numeric = _mm256_set1_epi8(NUMERIC);
+    const __m256i empty = _mm256_set1_epi8(EMPTYDATA);
+    int k = 0;
+    for (; k + 32 <= count; k += 32) {
+        __m256i t = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(tag + k));
+        __m256i ok = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(t, result),
+                                _mm256_cmpeq_epi8(t, numeric)),
+                _mm256_cmpeq_epi8(t, empty));
+        if (_mm256_movemask_epi8(ok) != -1)
+            return false;
+    }
+    for (; k < count; ++k)
+        if (!summable(tag[k]))
+            return false;
+    __m256d lanes_sum = _mm256_setzero_pd(), lanes_prod = _mm256_set1_pd(1.);
+    for (k = 0; k + 4 <= count; k += 4) {
+        __m256d v = _mm256_loadu_pd(number + k);
+        lanes_sum = _mm256_add_pd(lanes_sum, v);
+        lanes_prod = _mm256_mul_pd(lanes_prod, v);
+    }
+    double lane_sum[4], lane_prod[4];
+    _mm256_storeu_pd(lane_sum, lanes_sum);
+    _mm256_storeu_pd(lane_prod, lanes_prod);
+    for (; k < count; ++k) {
+        lane_sum[k % 4] += number[k];
+        lane_prod[k % 4] *= number[k];
+    }
+    sum += (lane_sum[0] + lane_sum[1]) + (lane_sum[2] + lane_sum[3]);
+    product *= (lane_prod[0] * lane_prod[1]) * (lane_prod[2] * lane_prod[3]);
+    return true;
+}
+#endif
+
+AggregateKernel selectKernel() {
+#ifdef TABLE_SIMD_X86
+    if (__builtin_cpu_supports("avx2"))
+        return aggregateAvx2;
+    return aggregateSse2;
+#else
+    return aggregateScalar;
+#endif
+}
+
+Table::Partial Table::aggregateTile(int bx, int by, int l_1, int r_1,
+                                    int l_2, int r_2, bool moments,
+                                    bool counting) const {
+    static const AggregateKernel aggregate = selectKernel();
+    Partial partial;
+    auto found = sheet->blocks.find({bx, by});
+    if (found == sheet->blocks.end()) {
+        partial.state = EMPTYRESULT;
+        return partial;
+    }
+    const Block& block = *found->second;
+    int from = std::max(l_1, bx * BLOCKSIZE) - bx * BLOCKSIZE;
+    int count = std::min(l_2, bx * BLOCKSIZE + BLOCKSIZE - 1) -
+                bx * BLOCKSIZE - from + 1;
+    int first = std::max(r_1, by * BLOCKSIZE) - by * BLOCKSIZE;
+    int last = std::min(r_2, by * BLOCKSIZE + BLOCKSIZE - 1) - by * BLOCKSIZE;
+    for (int y = first; y <= last; ++y) {
+        const auto& tag = block.tag[y];
+        const double* number = &block.number[y][from];
+        if (partial.state == FORMULAWITHRESULT) {
+            Partial row;
+            if (aggregate(number, &tag[from], count, row.sum, row.product)) {
+                row.count = count;
+                double mean = row.sum / count;
+                for (int k = 0; k < count && moments; ++k) {
+                    row.minimum = std::min(row.minimum, number[k]);
+                    row.maximum = std::max(row.maximum, number[k]);
+                    row.deviation += (number[k] - mean) * (number[k] - mean);
+                }
+                merge(partial, row);
+                continue;
+            }
+            partial.state = EMPTYRESULT;
+            for (int k = from; k < from + count; ++k)
+                if (tag[k] == CIRCULAR)
+                    partial.state = CYCLE;
+            if (!counting)
+                return partial;
+        }
+        for (int k = from; k < from + count; ++k) {
+            partial.count += summable(tag[k]);
+            partial.circular = partial.circular || tag[k] == CIRCULAR;
+        }
+    }
+    return partial;
+}
+
+// Chan et al. pairwise update, so the squared deviations of rows and tiles
+// combine without a second pass over the range.
+void Table::merge(Partial& total, const Partial& part) {
+    if (total.count && part.count) {
+        double delta = part.sum / part.count - total.sum / total.count;
+        total.deviation += part.deviation + delta * delta * total.count *
+                part.count / (total.count + part.count);
+    }
+    else
+        total.deviation += part.deviation;
+    total.sum += part.sum;
+    total.product *= part.product;
+    total.minimum = std::min(total.minimum, part.minimum);
+    total.maximum = std::max(total.maximum, part.maximum);
+    total.count += part.count;
+    total.circular = total.circular || part.circular;
+    if (total.state == FORMULAWITHRESULT)
+        total.state = part.state;
+}
+
+uint64_t Table::evaluate(const std::vector<std::pair<int, int>>& cells,
+                         bool split) const {
+    const Formula& range = formulaAt(cells[0].first, cells[0].second);
+    int l_1 = range.start.first, r_1 = range.start.second;
+    int l_2 = range.end.first, r_2 = range.end.second;
+    double area = (l_2 - l_1 + 1.) * (r_2 - r_1 + 1.);
+    bool summing = false, scan = false, moments = false, counting = false;
+    for (const auto& [row, column] : cells)
+        switch (formulaAt(row, column).operation) {
+            case '+': case '~': summing = true;
+                break;
+            case '*': scan = true;
+                break;
+            case '#': scan = counting = true;
+                break;
+            case '<': case '>': case '^': case '|': scan = moments = true;
+        }
+    double indexed_sum = 0.;
+    bool indexed = summing && prefixIndex &&
+                   prefixRangeSum(l_1, r_1, l_2, r_2, indexed_sum);
+    scan = scan || (summing && !indexed);
+    std::vector<std::pair<int, int>> tiles;
+    for (int by = r_1 / BLOCKSIZE; by <= r_2 / BLOCKSIZE && scan; ++by)
+        for (int bx = l_1 / BLOCKSIZE; bx <= l_2 / BLOCKSIZE; ++bx)
+            tiles.emplace_back(bx, by);
+    std::vector<Partial> partials;
+    if (split && pool && tiles.size() >= PARALLELTILES) {
+        partials.resize(tiles.size());
+        pool->run(tiles.size(), [&](size_t k) {
+            partials[k] = aggregateTile(tiles[k].first, tiles[k].second,
+                                        l_1, r_1, l_2, r_2, moments,
+                                        counting);
+        });
+    }
+    Partial total;
+    for (size_t k = 0; k < tiles.size() &&
+         (counting || total.state == FORMULAWITHRESULT); ++k)
+        merge(total, partials.empty() ?
+                     aggregateTile(tiles[k].first, tiles[k].second, l_1, r_1,
+                                   l_2, r_2, moments, counting) :
+                     partials[k]);
+    if (indexed)
+        total.sum = indexed_sum;
+    for (const auto& [row, column] : cells) {
+        char operation = formulaAt(row, column).operation;
+        CellType state = total.state;
+        if (operation == '?')
+            continue;
+        if (operation == '#')
+            state = total.circular ? CYCLE : FORMULAWITHRESULT;
+        setState(row, column, state);
+        if (state != FORMULAWITHRESULT)
+            continue;
+        switch (operation) {
+            case '+': setResult(row, column, total.sum);
+                break;
+            case '*': setResult(row, column, total.product);
+                break;
+            case '~': setResult(row, column, total.sum / area);
+                break;
+            case '<': setResult(row, column, total.minimum);
+                break;
+            case '>': setResult(row, column, total.maximum);
+                break;
+            case '#': setResult(row, column, total.count);
+                break;
+            case '^': setResult(row, column, total.deviation / area);
+                break;
+            case '|': setResult(row, column, std::sqrt(total.deviation /
+                                                       area));
+        }
+    }
+    return scan ? static_cast<uint64_t>(area) : 0;
+}
+
+bool Table::isFormula(int row, int column) const {
+    CellType state = typeAt(row, column);
+    return state == FORMULAWITHRESULT || state == EMPTYRESULT || state == CYCLE;
+}
+
+// Each distinct range is filed under every block it overlaps, unless it
+// spans more than WIDERANGE blocks; those few go to wide and are checked
+// on every lookup instead.
+template <typename Visit>
+void Table::eachBlock(const Range& range, Visit&& visit) {
+    int bx_1 = std::max(range.first.first, 0) / BLOCKSIZE;
+    int by_1 = std::max(range.first.second, 0) / BLOCKSIZE;
+    int bx_2 = range.second.first / BLOCKSIZE;
+    int by_2 = range.second.second / BLOCKSIZE;
+    for (int by = by_1; by <= by_2; ++by)
+        for (int bx = bx_1; bx <= bx_2; ++bx)
+            visit(std::make_pair(bx, by));
+}
+
+size_t Table::shardOf(const Range& range) {
+    uint64_t key = 0;
+    for (int part : {range.first.first, range.first.second,
+                     range.second.first, range.second.second})
+        key = (key ^ static_cast<uint32_t>(part)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(key >> 32) % SHARDCOUNT;
+}
+
+void Table::link(Sheet& data, const Range& range,
+                 const std::pair<int, int>& cell) {
+    std::set<std::pair<int, int>>& formulas =
+            own(data.dependents[shardOf(range)])[range];
+    if (formulas.empty()) {
+        uint64_t blocks = 0;
+        int64_t rows = range.second.first / BLOCKSIZE -
+                       std::max(range.first.first, 0) / BLOCKSIZE + 1;
+        int64_t columns = range.second.second / BLOCKSIZE -
+                          std::max(range.first.second, 0) / BLOCKSIZE + 1;
+        if (rows > 0 && columns > 0)
+            blocks = static_cast<uint64_t>(rows) *
+                     static_cast<uint64_t>(columns);
+        if (blocks > WIDERANGE)
+            own(data.wide).insert(range);
+        else
+            eachBlock(range, [&](const std::pair<int, int>& block) {
+                own(data.coverage[block]).insert(range);
+            });
+    }
+    formulas.insert(cell);
+}
+
+bool Table::unlink(Sheet& data, const Range& range,
+                   const std::pair<int, int>& cell) {
+    std::shared_ptr<Dependents>& shard = data.dependents[shardOf(range)];
+    if (!shard || !shard->count(range))
+        return false;
+    auto found = own(shard).find(range);
+    found->second.erase(cell);
+    if (!found->second.empty())
+        return false;
+    shard->erase(found);
+    if (data.wide && data.wide->count(range))
+        own(data.wide).erase(range);
+    else
+        eachBlock(range, [&](const std::pair<int, int>& block) {
+            auto bucket = data.coverage.find(block);
+            own(bucket->second).erase(range);
+            if (bucket->second->empty())
+                data.coverage.erase(bucket);
+        });
+    return true;
+}
+
+template <typename Visit>
+void Table::coveringRanges(int row, int column, Visit&& visit) const {
+    auto covers = [row, column](const Range& range) {
+        return range.first.first <= row && row <= range.second.first &&
+               range.first.second <= column && column <= range.second.second;
+    };
+    auto bucket = sheet->coverage.find({row / BLOCKSIZE, column / BLOCKSIZE});
+    if (bucket != sheet->coverage.end())
+        for (const Range& range : *bucket->second)
+            if (covers(range))
+                visit(range);
+    if (sheet->wide)
+        for (const Range& range : *sheet->wide)
+            if (covers(range))
+                visit(range);
+}
+
+std::vector<std::pair<int, int>> Table::dependentsOf(int row,
+                                                     int column) const {
+    std::vector<std::pair<int, int>> cells;
+    coveringRanges(row, column, [&](const Range& range) {
+        const auto& formulas = sheet->dependents[shardOf(range)]->at(range);
+        cells.insert(cells.end(), formulas.begin(), formulas.end());
+    });
+    return cells;
+}
+
+void Table::forget(int row, int column) const {
+    if (!sheet->cached)
+        return;
+    std::vector<Range> covering;
+    coveringRanges(row, column, [&](const Range& range) {
+        covering.push_back(range);
+    });
+    for (const Range& range : covering)
+        forget(range);
+}
+
+// Only a shard that holds entries for the range is copied.
+void Table::forget(const Range& range) const {
+    std::pair<Range, char> first{range, std::numeric_limits<char>::min()};
+    const std::shared_ptr<Cache>& held = sheet->cache[shardOf(range)];
+    if (!held)
+        return;
+    auto entry = held->lower_bound(first);
+    if (entry == held->end() || entry->first.first != range)
+        return;
+    Sheet& data = unshare();
+    Cache& cache = own(data.cache[shardOf(range)]);
+    entry = cache.lower_bound(first);
+    while (entry != cache.end() && entry->first.first == range) {
+        entry = cache.erase(entry);
+        --data.cached;
+    }
+}
+
+bool Table::recall(const std::vector<std::pair<int, int>>& cells) const {
+    if (!rangeCache)
+        return false;
+    const Formula& range = formulaAt(cells[0].first, cells[0].second);
+    Range key{range.start, range.end};
+    const Cache* cache = sheet->cache[shardOf(key)].get();
+    std::vector<const Cached*> found;
+    for (const auto& [row, column] : cells) {
+        char operation = formulaAt(row, column).operation;
+        if (operation == '?') {
+            found.push_back(nullptr);
+            continue;
+        }
+        if (!cache)
+            return false;
+        auto entry = cache->find({key, operation});
+        if (entry == cache->end())
+            return false;
+        found.push_back(&entry->second);
+    }
+    for (size_t k = 0; k < cells.size(); ++k)
+        if (found[k]) {
+            setState(cells[k].first, cells[k].second, found[k]->state);
+            setResult(cells[k].first, cells[k].second, found[k]->value);
+            ++hits;
+        }
+    return true;
+}
+
+void Table::remember(const std::vector<std::pair<int, int>>& cells) const {
+    if (!rangeCache)
+        return;
+    const Formula& range = formulaAt(cells[0].first, cells[0].second);
+    Range key{range.start, range.end};
+    for (const auto& [row, column] : cells) {
+        char operation = formulaAt(row, column).operation;
+        if (operation == '?')
+            continue;
+        Sheet& data = unshare();
+        Cached value{typeAt(row, column), numberAt(row, column)};
+        if (own(data.cache[shardOf(key)]).insert_or_assign(
+                    {key, operation}, value).second)
+            ++data.cached;
+        ++misses;
+    }
+}
 
-TableCell::TableCell() {
-    dataText = "";
-    dataNumber = 0.0;
-    type = NONE;
+void Table::setRangeCache(bool enabled) {
+    rangeCache = enabled;
+    if (!enabled && sheet->cached) {
+        Sheet& data = unshare();
+        data.cache = {};
+        data.cached = 0;
+    }
 }
 
-TableCell::TableCell(std::string& value) {
-    dataText = value;
-    dataNumber = 0.;
-    type = TEXT;
+size_t Table::cacheHits() const {
+    return hits;
 }
 
-TableCell::TableCell(double value) {
-    dataText = "";
-    dataNumber = value;
-    type = NUMBER;
+size_t Table::cacheMisses() const {
+    return misses;
 }
 
-TableCell::TableCell(const TableCell& copy) {
-    dataText = copy.dataText;
-    dataNumber = copy.dataNumber;
-    type = copy.type;
+void Table::check(int row, int column) {
+    if (batchDepth)
+        dirty.insert({row, column});
+    else {
+        check({{row, column}});
+        checkpointIfDue();
+    }
 }
 
-void TableCell::print() const {
-    if (type == TEXT) {
-        std::cout << "Data: " << dataText << '\n';
+void Table::check(const std::set<std::pair<int, int>>& cells) {
+    if (lazy) {
+        invalidate(cells);
         return;
     }
-    if (type == NUMBER) {
-        std::cout << "Data: " << dataNumber << '\n';
-    }
+    std::vector<std::pair<int, int>> order;
+    std::map<std::pair<int, int>, int> degree;
+    std::map<std::pair<int, int>, std::vector<std::pair<int, int>>> edges;
+    for (const auto& [row, column] : cells)
+        if (isFormula(row, column)) {
+            if (degree.emplace(std::make_pair(row, column), 0).second)
+                order.emplace_back(row, column);
+        }
+        else
+            for (const auto& cell : dependentsOf(row, column))
+                if (degree.emplace(cell, 0).second)
+                    order.push_back(cell);
+    for (size_t k = 0; k < order.size(); ++k)
+        for (const auto& cell : dependentsOf(order[k].first, order[k].second)) {
+            edges[order[k]].push_back(cell);
+            if (degree.emplace(cell, 0).second)
+                order.push_back(cell);
+            ++degree[cell];
+        }
+    for (const auto& [row, column] : cells)
+        forget(row, column);
+    for (const auto& [row, column] : order)
+        forget(row, column);
+    evaluateLevels(degree, edges);
 }
 
-double TableCell::getNumberData() const {
-    return dataNumber;
+void Table::evaluateLevels(std::map<std::pair<int, int>, int>& degree,
+                           std::map<std::pair<int, int>,
+                           std::vector<std::pair<int, int>>>& edges) const {
+    std::vector<std::pair<int, int>> ready;
+    for (const auto& [cell, count] : degree)
+        if (!count)
+            ready.push_back(cell);
+#if TABLE_STATISTICS
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point begin = Clock::now();
+    uint64_t formulas = counters.formulas, cells = counters.cells;
+#endif
+    while (!ready.empty()) {
+        std::map<Range, std::vector<std::pair<int, int>>> ranges;
+        for (const auto& [row, column] : ready) {
+            const Formula& formula = formulaAt(row, column);
+            ranges[{formula.start, formula.end}].emplace_back(row, column);
+        }
+        std::vector<std::vector<std::pair<int, int>>> groups;
+        for (auto& [range, cells] : ranges)
+            if (!recall(cells))
+                groups.push_back(std::move(cells));
+        std::vector<std::pair<uint64_t, double>> costs(groups.size());
+        auto run = [&](size_t k, bool split) {
+#if TABLE_STATISTICS
+            Clock::time_point start = Clock::now();
+            costs[k].first = evaluate(groups[k], split);
+            costs[k].second = std::chrono::duration<double, std::micro>(
+                    Clock::now() - start).count();
+#else
+            evaluate(groups[k], split);
+#endif
+        };
+        if (pool && groups.size() > 1) {
+            for (const auto& [row, column] : ready) {
+                blockAt(row, column);
+                prepare(row, column);
+            }
+            pool->run(groups.size(), [&](size_t k) { run(k, false); });
+        }
+        else
+            for (size_t k = 0; k < groups.size(); ++k)
+                run(k, true);
+        for (size_t k = 0; k < groups.size(); ++k) {
+            remember(groups[k]);
+            record(groups[k], costs[k].first, costs[k].second);
+        }
+        std::vector<std::pair<int, int>> level;
+        for (const auto& cell : ready)
+            for (const auto& next : edges[cell])
+                if (!--degree[next])
+                    level.push_back(next);
+        ready.swap(level);
+    }
+    for (const auto& [cell, count] : degree)
+        if (count)
+            setState(cell.first, cell.second, CYCLE);
+#if TABLE_STATISTICS
+    if (degree.empty())
+        return;
+    counters.lastMicroseconds = std::chrono::duration<double, std::micro>(
+            Clock::now() - begin).count();
+    counters.lastFormulas = counters.formulas - formulas;
+    counters.lastCells = counters.cells - cells;
+    counters.microseconds += counters.lastMicroseconds;
+    ++counters.recalculations;
+#endif
 }
 
-std::string TableCell::getTextData() const {
-    return dataText;
+void Table::record(
+        [[maybe_unused]] const std::vector<std::pair<int, int>>& cells,
+        [[maybe_unused]] uint64_t scanned,
+        [[maybe_unused]] double microseconds) const {
+#if TABLE_STATISTICS
+    counters.cells += scanned;
+    double share = microseconds / cells.size();
+    for (const auto& [row, column] : cells) {
+        char operation = formulaAt(row, column).operation;
+        if (operation == '?')
+            continue;
+        ++counters.formulas;
+        ++counters.operationCount[operation];
+        counters.operationMicroseconds[operation] += share;
+        auto& costliest = counters.costliest;
+        auto same = std::find_if(costliest.begin(), costliest.end(),
+                                 [&](const RecalcStatistics::Costly& entry) {
+            return entry.row == row && entry.column == column;
+        });
+        if (same != costliest.end() && same->microseconds >= share)
+            continue;
+        if (same == costliest.end() &&
+            costliest.size() == RecalcStatistics::COSTLIEST &&
+            costliest.back().microseconds >= share)
+            continue;
+        if (same == costliest.end()) {
+            if (costliest.size() == RecalcStatistics::COSTLIEST)
+                costliest.pop_back();
+            costliest.emplace_back();
+            same = costliest.end() - 1;
+        }
+        *same = {row, column, operation, scanned, share};
+        std::sort(costliest.begin(), costliest.end(),
+                  [](const RecalcStatistics::Costly& left,
+                     const RecalcStatistics::Costly& right) {
+            return left.microseconds > right.microseconds;
+        });
+    }
+#endif
 }
 
-char TableCell::getDataType() const {
-    switch (type) {
-        case NUMBER: return '0';
-        case TEXT: return 's';
-        case NONE: return 'E';
-    }
+const RecalcStatistics& Table::statistics() const {
+    return counters;
 }
 
-void TableCell::update(std::string& new_value) {
-    dataText = new_value;
-    dataNumber = 0;
-    type = TEXT;
+void Table::resetStatistics() {
+    counters = RecalcStatistics();
 }
 
-void TableCell::update(double new_value) {
-    dataText = "";
-    dataNumber = new_value;
-    type = NUMBER;
+void RecalcStatistics::dump(std::ostream& output) const {
+    output << "{\"recalculations\":" << recalculations
+           << ",\"formulas\":" << formulas << ",\"cells\":" << cells
+           << ",\"microseconds\":" << microseconds
+           << ",\"last\":{\"formulas\":" << lastFormulas
+           << ",\"cells\":" << lastCells
+           << ",\"microseconds\":" << lastMicroseconds
+           << "},\"operations\":{";
+    for (auto entry = operationCount.begin(); entry != operationCount.end();
+         ++entry)
+        output << (entry == operationCount.begin() ? "" : ",") << '"'
+               << entry->first << "\":{\"count\":" << entry->second
+               << ",\"microseconds\":"
+               << operationMicroseconds.at(entry->first) << '}';
+    output << "},\"costliest\":[";
+    for (size_t k = 0; k < costliest.size(); ++k)
+        output << (k ? "," : "") << "{\"row\":" << costliest[k].row
+               << ",\"column\":" << costliest[k].column
+               << ",\"operation\":\"" << costliest[k].operation
+               << "\",\"cells\":" << costliest[k].cells
+               << ",\"microseconds\":" << costliest[k].microseconds << '}';
+    output << "]}";
 }
 
-std::string TableCell::cellType() const {
-    std::string typeOfCell = "Data cell";
-    return typeOfCell;
+void Table::invalidate(const std::set<std::pair<int, int>>& cells) {
+    std::vector<std::pair<int, int>> order;
+    for (const auto& [row, column] : cells)
+        if (isFormula(row, column)) {
+            if (stale.emplace(row, column).second)
+                order.emplace_back(row, column);
+        }
+        else
+            for (const auto& cell : dependentsOf(row, column))
+                if (stale.insert(cell).second)
+                    order.push_back(cell);
+    for (size_t k = 0; k < order.size(); ++k)
+        for (const auto& cell : dependentsOf(order[k].first, order[k].second))
+            if (stale.insert(cell).second)
+                order.push_back(cell);
+    for (const auto& [row, column] : cells)
+        forget(row, column);
+    for (const auto& [row, column] : order)
+        forget(row, column);
 }
 
-CellWithFormula::CellWithFormula() : TableCell() {
-    std::pair<int, int> temp{0, 0};
-    start = temp;
-    end = temp;
-    result = 0.;
-    operation = EMPTY;
+std::vector<std::pair<int, int>> Table::staleInputs(
+        const std::set<std::pair<int, int>>& cells, int row,
+        int column) const {
+    const Formula& formula = formulaAt(row, column);
+    std::pair<int, int> start = formula.start;
+    std::pair<int, int> end = formula.end;
+    std::vector<std::pair<int, int>> inputs;
+    for (auto cell = cells.lower_bound({start.first, start.second});
+         cell != cells.end() && cell->first <= end.first; ++cell)
+        if (start.second <= cell->second && cell->second <= end.second)
+            inputs.push_back(*cell);
+    return inputs;
 }
 
-CellWithFormula::CellWithFormula(const std::pair<int, int>& start_cell,
-                                 const std::pair<int, int>& end_cell,
-                                 char type): TableCell() {
-    start = start_cell;
-    end = end_cell;
-    result = 0.;
-    switch (type) {
-        case '+': operation = SUM;
-            break;
-        case '*': operation = PRODUCT;
-            break;
-        case '~': operation = AVERAGE;
-            break;
-        default: operation = EMPTY;
-    }
+void Table::resolve(int row, int column) const {
+    if (stale.find({row, column}) == stale.end())
+        return;
+    std::set<std::pair<int, int>> needed{{row, column}};
+    std::vector<std::pair<int, int>> order{{row, column}};
+    for (size_t k = 0; k < order.size(); ++k)
+        for (const auto& cell : staleInputs(stale, order[k].first,
+                                            order[k].second))
+            if (needed.insert(cell).second)
+                order.push_back(cell);
+    refresh(needed);
 }
 
-CellWithFormula::CellWithFormula(const CellWithFormula &copy)  :
-TableCell(copy) {
-    start = copy.start;
-    end = copy.end;
-    result = copy.result;
-    operation = copy.operation;
+void Table::refresh(const std::set<std::pair<int, int>>& cells) const {
+    std::map<std::pair<int, int>, int> degree;
+    std::map<std::pair<int, int>, std::vector<std::pair<int, int>>> edges;
+    for (const auto& cell : cells) {
+        degree.emplace(cell, 0);
+        for (const auto& input : staleInputs(cells, cell.first, cell.second)) {
+            edges[input].push_back(cell);
+            ++degree[cell];
+        }
+    }
+    for (const auto& cell : cells)
+        stale.erase(cell);
+    evaluateLevels(degree, edges);
 }
 
-CellWithFormula::CellWithFormula(const TableCell& copy) {
-    operation = EMPTY;
-    dataText = copy.getTextData();
-    dataNumber = copy.getNumberData();
-    switch (copy.getDataType()) {
-        case '0': type = NUMBER;
-            break;
-        case 's': type = TEXT;
-            break;
-        case 'E': type = NONE;
+void Table::setLazy(bool enabled) {
+    lazy = enabled;
+    if (!enabled) {
+        std::set<std::pair<int, int>> cells = stale;
+        refresh(cells);
     }
 }
 
-void CellWithFormula::print() const {
-    if (operation == EMPTY) {
-        std::cout << "No formula is found\n";
-        return;
+bool Table::save(const std::string& path) const {
+    refresh(std::set<std::pair<int, int>>(stale));
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    const Sheet& data = *sheet;
+    std::vector<TextEntry> texts;
+    std::unordered_map<uint32_t, uint32_t> offsets;
+    std::string heap;
+    for (const auto& [position, block] : data.blocks)
+        for (int y = 0; y < BLOCKSIZE; ++y)
+            for (int x = 0; x < BLOCKSIZE; ++x) {
+                uint32_t handle = block->payload[y][x];
+                if (block->tag[y][x] != TEXTUAL)
+                    continue;
+                std::string_view text = data.strings.view(handle);
+                auto offset = offsets.emplace(handle, heap.size());
+                if (offset.second)
+                    heap += text;
+                texts.push_back({position.first * BLOCKSIZE + x,
+                                 position.second * BLOCKSIZE + y,
+                                 offset.first->second,
+                                 static_cast<uint32_t>(text.size())});
+            }
+    SnapshotHeader header{{'T', 'B', 'L', 'S'}, 2, BLOCKSIZE, 0,
+                          data.blocks.size(), texts.size(),
+                          data.formulas.size() - data.releasedFormulas.size(),
+                          heap.size()};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& [position, block] : data.blocks) {
+        int32_t key[2] = {position.first, position.second};
+        file.write(reinterpret_cast<const char*>(key), sizeof(key));
+        file.write(reinterpret_cast<const char*>(block->number.data()),
+                   sizeof(block->number));
+        file.write(reinterpret_cast<const char*>(block->tag.data()),
+                   sizeof(block->tag));
     }
-    std::cout << "Result: " << result << '\n';
+    file.write(reinterpret_cast<const char*>(texts.data()),
+               static_cast<std::streamsize>(texts.size() * sizeof(TextEntry)));
+    for (const auto& [position, block] : data.blocks)
+        for (int y = 0; y < BLOCKSIZE; ++y)
+            for (int x = 0; x < BLOCKSIZE; ++x) {
+                if (block->tag[y][x] < NORESULT)
+                    continue;
+                const Formula& formula = data.formulas[block->payload[y][x]];
+                FormulaEntry entry{position.first * BLOCKSIZE + x,
+                                   position.second * BLOCKSIZE + y,
+                                   formula.start.first, formula.start.second,
+                                   formula.end.first, formula.end.second,
+                                   formula.operation, 0};
+                file.write(reinterpret_cast<const char*>(&entry),
+                           sizeof(entry));
+            }
+    file.write(heap.data(), static_cast<std::streamsize>(heap.size()));
+    return static_cast<bool>(file.flush());
 }
 
-std::pair<int, int> CellWithFormula::getStartCell() const {
-    return start;
+bool Table::load(const std::string& path) {
+#ifdef TABLE_MMAP
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+    struct stat info{};
+    if (fstat(descriptor, &info) || info.st_size <= 0) {
+        close(descriptor);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (image == MAP_FAILED)
+        return false;
+    bool loaded = restore(static_cast<const char*>(image), size);
+    munmap(image, size);
+#else
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+    bool loaded = file.eof() && restore(image.data(), image.size());
+#endif
+    return loaded && (!journal || checkpoint());
 }
 
-std::pair<int, int> CellWithFormula::getEndCell() const {
-    return end;
+uint32_t journalChecksum(std::string_view payload) {
+    uint32_t hash = 2166136261u;
+    for (char symbol : payload)
+        hash = (hash ^ static_cast<unsigned char>(symbol)) * 16777619u;
+    return hash;
 }
 
-char CellWithFormula::getOperationType() const {
-    switch (operation) {
-        case SUM: return '+';
-        case PRODUCT: return '*';
-        case AVERAGE: return '~';
-        case EMPTY: return '?';
-    }
+// Each record is its payload length and FNV-1a checksum followed by the
+// payload: a kind byte ('n', 's', 'e' or 'f'), the row and column, then
+// the number, the text, nothing, or the formula bounds and operation.
+void Table::log(char kind, int row, int column, std::string_view payload) {
+    std::string record(8, '\0');
+    int32_t position[2] = {row, column};
+    record += kind;
+    record.append(reinterpret_cast<const char*>(position), sizeof(position));
+    record.append(payload.data(), payload.size());
+    uint32_t header[2] = {static_cast<uint32_t>(record.size() - 8),
+                          journalChecksum(std::string_view(record).substr(8))};
+    std::memcpy(&record[0], header, sizeof(header));
+    journal->append(record);
+    ++journalRecords;
 }
 
-void CellWithFormula::update(const std::pair<int, int>& start_cell,
-                             const std::pair<int, int>& end_cell, char type) {
-    start = start_cell;
-    end = end_cell;
-    switch (type) {
-        case '+': operation = SUM;
+bool Table::replay(const std::string& path, uint64_t& valid) {
+    valid = 0;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return !std::filesystem::exists(path);
+    std::string image((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+    const size_t fixed = 1 + 2 * sizeof(int32_t);
+    beginBatch();
+    for (size_t cursor = 0; image.size() - cursor >= 8;) {
+        uint32_t header[2];
+        std::memcpy(header, &image[cursor], sizeof(header));
+        if (header[0] < fixed || image.size() - cursor - 8 < header[0])
             break;
-        case '*': operation = PRODUCT;
+        std::string_view record = std::string_view(image).substr(cursor + 8,
+                                                                 header[0]);
+        if (journalChecksum(record) != header[1])
             break;
-        case '~': operation = AVERAGE;
+        int32_t position[2];
+        std::memcpy(position, record.data() + 1, sizeof(position));
+        std::string_view payload = record.substr(fixed);
+        int32_t bounds[5];
+        double number;
+        if (record[0] == 'n' && payload.size() == sizeof(number)) {
+            std::memcpy(&number, payload.data(), sizeof(number));
+            update(position[0], position[1], TableCell(number));
+        }
+        else if (record[0] == 's')
+            update(position[0], position[1],
+                   TableCell(std::string(payload)));
+        else if (record[0] == 'e' && payload.empty())
+            update(position[0], position[1], TableCell());
+        else if (record[0] == 'f' && payload.size() == sizeof(bounds)) {
+            std::memcpy(bounds, payload.data(), sizeof(bounds));
+            update(position[0], position[1],
+                   CellWithFormula({bounds[0], bounds[1]},
+                                   {bounds[2], bounds[3]},
+                                   static_cast<char>(bounds[4])));
+        }
+        else
             break;
-        default: operation = EMPTY;
+        cursor += 8 + header[0];
+        valid = cursor;
     }
+    commitBatch();
+    return true;
 }
 
-std::string CellWithFormula::cellType() const {
-    std::string typeOfCell = "Formula cell";
-    return typeOfCell;
+bool Table::openJournal(const std::string& path, size_t interval) {
+    journal.reset();
+    std::string snapshot = path + ".snapshot";
+    uint64_t valid;
+    if ((std::filesystem::exists(snapshot) && !load(snapshot)) ||
+        !replay(path, valid))
+        return false;
+    std::error_code error;
+    if (std::filesystem::exists(path))
+        std::filesystem::resize_file(path, valid, error);
+    std::FILE* file = error ? nullptr : std::fopen(path.c_str(), "ab");
+    if (!file)
+        return false;
+    journal = std::make_unique<Journal>(file, path);
+    checkpointInterval = interval;
+    journalRecords = 0;
+    return true;
 }
 
-Table::Table(): CellWithFormula() {
-    std::array<CellType, MAXSIZE> temp{};
-    temp.fill(VOID);
-    type.fill(temp);
+bool Table::syncJournal() {
+    return journal && journal->sync();
 }
 
-Table::Table(int row, int column, const TableCell &cell):
-CellWithFormula(cell) {
-    std::array<CellType, MAXSIZE> temp{};
-    temp.fill(VOID);
-    type.fill(temp);
-    data[row][column] = CellWithFormula(cell);
-    type[row][column] = DATA;
+// The snapshot is made durable and renamed over the previous one, and the
+// rename is synced through the directory, before the log is emptied; a
+// crash in between replays records the snapshot already contains, which
+// leaves every cell with the same final value.
+bool Table::checkpoint() {
+    if (!journal || batchDepth)
+        return false;
+    std::string snapshot = journal->path() + ".snapshot";
+    std::string temporary = snapshot + ".tmp";
+    if (!save(temporary))
+        return false;
+#ifdef TABLE_MMAP
+    int descriptor = open(temporary.c_str(), O_RDONLY);
+    bool synced = descriptor >= 0 && !fsync(descriptor);
+    if (descriptor >= 0)
+        close(descriptor);
+    if (!synced)
+        return false;
+#endif
+    if (std::rename(temporary.c_str(), snapshot.c_str()))
+        return false;
+#ifdef TABLE_MMAP
+    std::string parent = std::filesystem::path(snapshot).parent_path();
+    descriptor = open(parent.empty() ? "." : parent.c_str(), O_RDONLY);
+    synced = descriptor >= 0 && !fsync(descriptor);
+    if (descriptor >= 0)
+        close(descriptor);
+    if (!synced)
+        return false;
+#endif
+    journalRecords = 0;
+    return journal->reset();
 }
 
-Table::Table(int row, int column, const CellWithFormula &cell) :
-CellWithFormula(cell) {
-    std::array<CellType, MAXSIZE> temp{};
-    temp.fill(VOID);
-    type.fill(temp);
-    data[row][column] = cell;
-    type[row][column] = EMPTYRESULT;
+void Table::checkpointIfDue() {
+    if (journal && checkpointInterval && !batchDepth &&
+        journalRecords >= checkpointInterval)
+        checkpoint();
 }
 
-Table::Table(const Table &copy): CellWithFormula(copy) {
-    data = copy.data;
-    type = copy.type;
+bool Table::restore(const char* image, size_t size) {
+    SnapshotHeader header{};
+    if (size < sizeof(header))
+        return false;
+    std::memcpy(&header, image, sizeof(header));
+    const size_t blockImage = 2 * sizeof(int32_t) +
+            sizeof(Block::number) + sizeof(Block::tag);
+    if (std::memcmp(header.magic, "TBLS", 4) || header.version != 2 ||
+        header.blockSize != BLOCKSIZE)
+        return false;
+    // Each section is checked by division against what is left, so counts
+    // from a corrupt header cannot wrap the total into a plausible size.
+    uint64_t left = size - sizeof(header);
+    if (header.blocks > left / blockImage)
+        return false;
+    left -= header.blocks * blockImage;
+    if (header.texts > left / sizeof(TextEntry))
+        return false;
+    left -= header.texts * sizeof(TextEntry);
+    if (header.formulas > left / sizeof(FormulaEntry))
+        return false;
+    left -= header.formulas * sizeof(FormulaEntry);
+    if (header.heapSize != left)
+        return false;
+    // Everything is built aside and swapped in only once the whole image
+    // has checked out, so a corrupt file leaves the table as it was.
+    std::shared_ptr<Sheet> fresh = std::make_shared<Sheet>();
+    const char* cursor = image + sizeof(header);
+    uint64_t texts = 0, cells = 0;
+    for (uint64_t k = 0; k < header.blocks; ++k) {
+        int32_t key[2];
+        std::memcpy(key, cursor, sizeof(key));
+        if (key[0] < 0 || key[1] < 0)
+            return false;
+        Block& block = *(fresh->blocks[{key[0], key[1]}] =
+                std::make_shared<Block>());
+        cursor += sizeof(key);
+        std::memcpy(block.number.data(), cursor, sizeof(block.number));
+        cursor += sizeof(block.number);
+        std::memcpy(block.tag.data(), cursor, sizeof(block.tag));
+        cursor += sizeof(block.tag);
+        for (const auto& column : block.tag)
+            for (CellTag tag : column) {
+                if (tag > CIRCULAR)
+                    return false;
+                texts += tag == TEXTUAL;
+                cells += tag >= NORESULT;
+            }
+    }
+    if (fresh->blocks.size() != header.blocks || texts != header.texts ||
+        cells != header.formulas)
+        return false;
+    auto cellAt = [&fresh](int32_t row, int32_t column, bool formula) {
+        auto block = fresh->blocks.find({row / BLOCKSIZE,
+                                         column / BLOCKSIZE});
+        if (row < 0 || column < 0 || block == fresh->blocks.end())
+            return static_cast<uint32_t*>(nullptr);
+        CellTag tag = block->second->tag[column % BLOCKSIZE][row % BLOCKSIZE];
+        if (formula ? tag < NORESULT : tag != TEXTUAL)
+            return static_cast<uint32_t*>(nullptr);
+        return &block->second->payload[column % BLOCKSIZE][row % BLOCKSIZE];
+    };
+    const char* heap = image + size - header.heapSize;
+    for (uint64_t k = 0; k < header.texts; ++k) {
+        TextEntry entry{};
+        std::memcpy(&entry, cursor, sizeof(entry));
+        cursor += sizeof(entry);
+        uint32_t* payload = cellAt(entry.row, entry.column, false);
+        if (!payload || static_cast<uint64_t>(entry.offset) + entry.length >
+                        header.heapSize)
+            return false;
+        *payload = fresh->strings.intern(
+                std::string_view(heap + entry.offset, entry.length));
+    }
+    for (uint64_t k = 0; k < header.formulas; ++k) {
+        FormulaEntry entry{};
+        std::memcpy(&entry, cursor, sizeof(entry));
+        cursor += sizeof(entry);
+        uint32_t* payload = cellAt(entry.row, entry.column, true);
+        Formula formula{{entry.startRow, entry.startColumn},
+                        {entry.endRow, entry.endColumn},
+                        static_cast<char>(entry.operation)};
+        if (!payload || entry.operation != formula.operation ||
+            !wellFormed(formula))
+            return false;
+        *payload = static_cast<uint32_t>(fresh->formulas.size());
+        fresh->formulas.push_back(formula);
+        link(*fresh, {formula.start, formula.end}, {entry.row, entry.column});
+    }
+    sheet.swap(fresh);
+    dirty.clear();
+    stale.clear();
+    return true;
 }
 
-void Table::print(int row, int column) const {
-    if (type[row][column] == DATA) {
-        switch (data[row][column].getDataType()) {
-            case '0': std::cout << data[row][column].getNumberData() << '\n';
-                break;
-            case 's': std::cout << data[row][column].getTextData() << '\n';
-                break;
-            case 'E': std::cout << "Cell is empty\n";
+// Ranges lie at non-negative coordinates with the start not past the end,
+// and the operation is one getOperationType() can return.
+bool Table::wellFormed(const Formula& formula) {
+    return formula.start.first >= 0 && formula.start.second >= 0 &&
+           formula.start.first <= formula.end.first &&
+           formula.start.second <= formula.end.second &&
+           formula.operation && std::strchr("+*~<>#^|?", formula.operation);
+}
+
+bool Table::importCsv(std::istream& input, int row, int column) {
+    CsvReader reader(input);
+    std::string_view field;
+    bool quoted, last;
+    beginBatch();
+    for (int x = row, y = column; reader.next(field, quoted, last);) {
+        if (quoted || !field.empty())
+            importField(x, y, field, quoted);
+        if (last) {
+            ++x;
+            y = column;
         }
+        else
+            ++y;
     }
-    else {
-        if (type[row][column] == FORMULAWITHRESULT) {
-            switch (data[row][column].getOperationType()) {
-                case '?': std::cout << "Cell is empty\n";
-                    break;
-                default: std::cout << data[row][column].result << '\n';
-            }
+    commitBatch();
+    return !reader.failed();
+}
+
+void Table::importField(int row, int column, std::string_view field,
+                        bool quoted) {
+    double number;
+    if (!quoted) {
+        auto [end, error] = std::from_chars(field.data(),
+                                            field.data() + field.size(),
+                                            number);
+        if (error == std::errc() && end == field.data() + field.size()) {
+            detach(row, column);
+            set(row, column, number, NUMBER, 0);
+            check(row, column);
+            return;
+        }
+        static const std::string_view prefixes[4] = {"R", "C", ":R", "C"};
+        int bounds[4];
+        bool formula = field.size() > 2 && field[0] == '=';
+        std::string_view rest = formula ? field.substr(2) : field;
+        for (int k = 0; k < 4 && formula; ++k) {
+            formula = rest.substr(0, prefixes[k].size()) == prefixes[k];
+            rest.remove_prefix(formula ? prefixes[k].size() : 0);
+            auto [end, error] = std::from_chars(rest.data(),
+                                                rest.data() + rest.size(),
+                                                bounds[k]);
+            formula = formula && error == std::errc();
+            rest.remove_prefix(end - rest.data());
+        }
+        formula = formula && rest.empty() &&
+                  wellFormed({{bounds[0], bounds[1]}, {bounds[2], bounds[3]},
+                              field[1]});
+        if (formula) {
+            update(row, column, CellWithFormula({bounds[0], bounds[1]},
+                                                {bounds[2], bounds[3]},
+                                                field[1]));
+            return;
         }
-        else
-            std::cout << "Cell is empty\n";
     }
+    detach(row, column);
+    set(row, column, 0., TEXT, unshare().strings.intern(field));
+    check(row, column);
 }
 
-void Table::check() {
-    for (size_t i = 0; i < MAXSIZE; ++i)
-        for (size_t j = 0; j < MAXSIZE; ++j)
-            if (type[i][j] == EMPTYRESULT || type[i][j] == FORMULAWITHRESULT) {
-                int l_1 = data[i][j].getStartCell().first,
-                r_1 = data[i][j].getStartCell().second;
-                int l_2 = data[i][j].getEndCell().first,
-                r_2 = data[i][j].getEndCell().second;
-                switch (data[i][j].getOperationType()) {
-                    case '+': {
-                        double curr_sum = 0;
-                        bool f = true;
-                        for (int x = l_1; x <= l_2 && f; ++x)
-                            for (int y = r_1; y <= r_2 && f; ++y) {
-                                if (type[x][y] != DATA ||
-                                (type[x][y] == DATA &&
-                                data[x][y].getDataType() == 's'))
-                                    f = false;
-                                else
-                                    curr_sum += data[x][y].getNumberData();
-                            }
-                        if (f) {
-                            data[i][j].result = curr_sum;
-                            type[i][j] = FORMULAWITHRESULT;
-                        }
-                        else
-                            type[i][j] = EMPTYRESULT;
-                    }
-                        break;
-                    case '*': {
-                        double curr_prod = 1;
-                        bool f = true;
-                        for (int x = l_1; x <= l_2 && f; ++x)
-                            for (int y = r_1; y <= r_2 && f; ++y)
-                                if (type[x][y] != DATA ||
-                                (type[x][y] == DATA &&
-                                data[x][y].getDataType() == 's'))
-                                    f = false;
-                                else
-                                    curr_prod *= data[x][y].getNumberData();
-                        if (f) {
-                            data[i][j].result = curr_prod;
-                            type[i][j] = FORMULAWITHRESULT;
-                        }
-                        else
-                            type[i][j] = EMPTYRESULT;
+void Table::exportCsv(std::ostream& output) const {
+    char number[32];
+    int row = 0;
+    const Sheet& data = *sheet;
+    for (auto band = data.blocks.begin(); band != data.blocks.end();) {
+        auto next = band;
+        while (next != data.blocks.end() &&
+               next->first.first == band->first.first)
+            ++next;
+        for (; row < band->first.first * BLOCKSIZE; ++row)
+            output << '\n';
+        for (int x = 0; x < BLOCKSIZE; ++x, ++row) {
+            int written = 0;
+            for (auto block = band; block != next; ++block)
+                for (int y = 0; y < BLOCKSIZE; ++y) {
+                    const Block& cells = *block->second;
+                    CellTag tag = cells.tag[y][x];
+                    if (tag == BLANK || tag == EMPTYDATA)
+                        continue;
+                    int target = block->first.second * BLOCKSIZE + y;
+                    for (; written < target; ++written)
+                        output << ',';
+                    if (tag >= NORESULT) {
+                        const Formula& formula =
+                                data.formulas[cells.payload[y][x]];
+                        output << '=' << formula.operation
+                               << 'R' << formula.start.first
+                               << 'C' << formula.start.second
+                               << ":R" << formula.end.first
+                               << 'C' << formula.end.second;
                     }
-                        break;
-                    case '~': {
-                        double curr_sum = 0;
-                        bool f = true;
-                        for (int x = l_1; x <= l_2 && f; ++x)
-                            for (int y = r_1; y <= r_2 && f; ++y)
-                                if (type[x][y] != DATA ||
-                                (type[x][y] == DATA &&
-                                data[x][y].getDataType() == 's'))
-                                    f = false;
-                                else
-                                    curr_sum += data[x][y].getNumberData();
-                        if (f){
-                            data[i][j].result = curr_sum /
-                                    ((l_2 - l_1 + 1) * (r_2 - r_1 + 1));
-                            type[i][j] = FORMULAWITHRESULT;
+                    else if (tag == NUMERIC)
+                        output.write(number, std::to_chars(
+                                number, number + sizeof(number),
+                                cells.number[y][x]).ptr - number);
+                    else {
+                        output << '"';
+                        for (char symbol :
+                                data.strings.view(cells.payload[y][x])) {
+                            if (symbol == '"')
+                                output << '"';
+                            output << symbol;
                         }
-                        else
-                            type[i][j] = EMPTYRESULT;
+                        output << '"';
                     }
                 }
-            }
+            output << '\n';
+        }
+        band = next;
+    }
+}
+
+void Table::attach(int row, int column) {
+    link(unshare(), {formulaAt(row, column).start, formulaAt(row, column).end},
+         {row, column});
+}
+
+void Table::detach(int row, int column) {
+    if (!isFormula(row, column))
+        return;
+    Range range{formulaAt(row, column).start, formulaAt(row, column).end};
+    if (unlink(unshare(), range, {row, column}))
+        forget(range);
 }
 
 void Table::update(int row, int column, const TableCell &cell) {
-    data[row][column] = CellWithFormula(cell);
-    type[row][column] = DATA;
-    check();
+    detach(row, column);
+    set(row, column, cell);
+    check(row, column);
 }
 
 void Table::update(int row, int column, const CellWithFormula &cell) {
-    data[row][column] = cell;
-    type[row][column] = EMPTYRESULT;
-    check();
+    detach(row, column);
+    set(row, column, cell);
+    attach(row, column);
+    check(row, column);
 }
 
-double Table::getCellData(int row, int column) const {
-    if (type[row][column] == DATA && data[row][column].getDataType() == '0')
-        return data[row][column].getNumberData();
+void Table::update(int row, int column, TableCell&& cell) {
+    detach(row, column);
+    if (cell.getDataType() == 's')
+        set(row, column, 0., TEXT,
+            unshare().strings.adopt(std::move(cell).getTextData()));
     else
-        return data[row][column].result;
+        set(row, column, cell);
+    check(row, column);
+}
+
+void Table::update(int row, int column, CellWithFormula&& cell) {
+    update(row, column, static_cast<const CellWithFormula&>(cell));
+}
+
+void Table::update(const std::vector<std::pair<std::pair<int, int>,
+                   TableCell>>& cells) {
+    beginBatch();
+    for (const auto& [position, cell] : cells)
+        update(position.first, position.second, cell);
+    commitBatch();
+}
+
+void Table::beginBatch() {
+    ++batchDepth;
+}
+
+void Table::commitBatch() {
+    if (!batchDepth || --batchDepth)
+        return;
+    std::set<std::pair<int, int>> cells;
+    cells.swap(dirty);
+    check(cells);
+    checkpointIfDue();
+}
+
+bool Table::publish() {
+    if (batchDepth)
+        return false;
+    refresh(std::set<std::pair<int, int>>(stale));
+    published.store(std::make_shared<Table>(*this));
+    return true;
+}
+
+std::shared_ptr<const Table> Table::snapshot() const {
+    return published.load();
+}
+
+double Table::getCellData(int row, int column) const {
+    resolve(row, column);
+    return numberAt(row, column);
 }
 
 char Table::getCellType(int row, int column) const {
-    if (type[row][column] == DATA)
+    resolve(row, column);
+    if (typeAt(row, column) == DATA)
         return 'd';
-    if (type[row][column] == FORMULAWITHRESULT)
+    if (typeAt(row, column) == FORMULAWITHRESULT)
         return '+';
-    if (type[row][column] == EMPTYRESULT)
+    if (typeAt(row, column) == EMPTYRESULT)
         return '-';
+    if (typeAt(row, column) == CYCLE)
+        return 'c';
     return '?';
 }
 
+std::string_view Table::getCellText(int row, int column) const {
+    return textAt(row, column);
+}
+
 std::string Table::cellType() const  {
     std::string typeofCell = "Table of cells";
     return typeofCell;
 }
 
-int main() {
+bool parseWorkload(int argc, char* argv[], Workload& workload) {
+    for (int k = 0; k < argc; ++k) {
+        std::string_view option = argv[k];
+        size_t equals = option.find('=');
+        if (equals == std::string_view::npos)
+            return false;
+        std::string_view key = option.substr(0, equals);
+        std::string value(option.substr(equals + 1));
+        char* end = nullptr;
+        double number = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end || !std::isfinite(number) || number < 0)
+            return false;
+        bool integral = key != "formulas" && key != "overlap" &&
+                        key != "reads";
+        double limit = key == "threads" || key == "seed" ?
+                       std::numeric_limits<unsigned>::max() :
+                       std::numeric_limits<int>::max();
+        if (integral && (number != std::floor(number) || number > limit))
+            return false;
+        if (key == "rows")
+            workload.rows = static_cast<int>(number);
+        else if (key == "columns")
+            workload.columns = static_cast<int>(number);
+        else if (key == "formulas")
+            workload.formulas = number;
+        else if (key == "height")
+            workload.height = static_cast<int>(number);
+        else if (key == "width")
+            workload.width = static_cast<int>(number);
+        else if (key == "overlap")
+            workload.overlap = number;
+        else if (key == "reads")
+            workload.reads = number;
+        else if (key == "operations")
+            workload.operations = static_cast<int>(number);
+        else if (key == "threads")
+            workload.threads = static_cast<unsigned>(number);
+        else if (key == "seed")
+            workload.seed = static_cast<unsigned>(number);
+        else
+            return false;
+    }
+    return workload.rows > 0 && workload.columns > 0 &&
+           workload.height > 0 && workload.width > 0 &&
+           workload.operations > 0;
+}
+
+void report(std::ostream& output, const char* name,
+            std::vector<double>& samples) {
+    std::sort(samples.begin(), samples.end());
+    double total = 0.;
+    for (double sample : samples)
+        total += sample;
+    auto percentile = [&](double rank) {
+        return samples[static_cast<size_t>(rank * (samples.size() - 1))];
+    };
+    output << name << ": " << samples.size() / total * 1e6 << " ops/s, p50 "
+           << percentile(.5) << " us, p90 " << percentile(.9) << " us, p99 "
+           << percentile(.99) << " us, max " << samples.back() << " us\n";
+}
+
+long peakResidentKilobytes() {
+#ifdef TABLE_MMAP
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Data fills rows x columns; formulas sit in the columns to the right of it
+// so the dependency graph stays acyclic, and each one covers a height x
+// width window that repeats an earlier window with probability overlap.
+void benchmark(const Workload& workload, std::ostream& output) {
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::micro>(Clock::now() -
+                                                         since).count();
+    };
+    std::mt19937 random(workload.seed);
+    auto uniform = [&random](int bound) {
+        return static_cast<int>(random() % static_cast<unsigned>(bound));
+    };
+    std::uniform_real_distribution<double> chance(0., 1.);
+    Table table;
+    table.setThreads(workload.threads);
+    long baseline = peakResidentKilobytes();
+    Clock::time_point start = Clock::now();
+    for (int x = 0; x < workload.rows; ++x)
+        for (int y = 0; y < workload.columns; ++y)
+            table.update(x, y, TableCell(1. + uniform(1000) / 1000.));
+    double load = elapsed(start);
+    int height = std::min(workload.height, workload.rows);
+    int width = std::min(workload.width, workload.columns);
+    int count = static_cast<int>(workload.formulas * workload.rows *
+                                 workload.columns);
+    std::vector<std::pair<int, int>> windows;
+    start = Clock::now();
+    table.beginBatch();
+    for (int k = 0; k < count; ++k) {
+        if (windows.empty() || chance(random) >= workload.overlap)
+            windows.emplace_back(uniform(workload.rows - height + 1),
+                                 uniform(workload.columns - width + 1));
+        std::pair<int, int> window = windows[uniform(
+                static_cast<int>(windows.size()))];
+        table.update(k % workload.rows, workload.columns + k / workload.rows,
+                     CellWithFormula(window, {window.first + height - 1,
+                                              window.second + width - 1},
+                                     "+*~<>#^|"[k % 8]));
+    }
+    table.commitBatch();
+    double recalc = elapsed(start);
+    long resident = peakResidentKilobytes() - baseline;
+    output << "sheet: " << workload.rows << "x" << workload.columns << ", "
+           << count << " formulas over " << height << "x" << width
+           << " windows, " << windows.size() << " distinct\n"
+           << "load: " << workload.rows * workload.columns / load * 1e6
+           << " cells/s\n"
+           << "recalc: " << count / recalc * 1e6 << " formulas/s, "
+           << recalc / 1000. << " ms\n"
+           << "memory: " << resident * 1024. / (workload.rows *
+                                               workload.columns)
+           << " bytes/cell, peak rss " << peakResidentKilobytes() << " KiB\n";
+    std::vector<double> updates, reads, mixed, copies;
+    for (int k = 0; k < workload.operations; ++k) {
+        int x = uniform(workload.rows), y = uniform(workload.columns);
+        start = Clock::now();
+        table.update(x, y, TableCell(1. + uniform(1000) / 1000.));
+        updates.push_back(elapsed(start));
+    }
+    double checksum = 0.;
+    for (int k = 0; k < workload.operations; ++k) {
+        int x = uniform(workload.rows);
+        int y = uniform(workload.columns + count / workload.rows + 1);
+        start = Clock::now();
+        checksum += table.getCellData(x, y);
+        reads.push_back(elapsed(start));
+    }
+    for (int k = 0; k < workload.operations; ++k) {
+        int x = uniform(workload.rows), y = uniform(workload.columns);
+        bool read = chance(random) < workload.reads;
+        start = Clock::now();
+        if (read)
+            checksum += table.getCellData(x, y);
+        else
+            table.update(x, y, TableCell(1. + uniform(1000) / 1000.));
+        mixed.push_back(elapsed(start));
+    }
+    for (int k = 0; k < std::min(workload.operations, 200); ++k) {
+        start = Clock::now();
+        Table copy(table);
+        copy.update(uniform(workload.rows), uniform(workload.columns),
+                    TableCell(0.));
+        copies.push_back(elapsed(start));
+    }
+    report(output, "update", updates);
+    report(output, "getCellData", reads);
+    report(output, "mixed", mixed);
+    report(output, "copy+write", copies);
+    output << "checksum: " << checksum << "\nstatistics: ";
+    table.statistics().dump(output);
+    output << '\n';
+    compareLayouts(workload, output);
+}
+
+// Times one data update under eight whole-sheet SUM/PRODUCT/AVERAGE
+// formulas twice: against the table, and against the layout the table had
+// before its column blocks, a row-major array of CellWithFormula objects
+// rescanned in full for every formula on every update.
+void compareLayouts(const Workload& workload, std::ostream& output) {
+    using Clock = std::chrono::steady_clock;
+    const int rows = workload.rows, columns = workload.columns;
+    const int passes = std::min(workload.operations, 20);
+    const char operations[] = "+*~";
+    std::mt19937 random(workload.seed);
+    auto uniform = [&random](int bound) {
+        return static_cast<int>(random() % static_cast<unsigned>(bound));
+    };
+    std::vector<CellWithFormula> objects;
+    std::vector<CellType> types(static_cast<size_t>(rows) * columns, DATA);
+    Table table;
+    for (int x = 0; x < rows; ++x)
+        for (int y = 0; y < columns; ++y) {
+            TableCell cell(1. + uniform(1000) / 1000.);
+            table.update(x, y, cell);
+            objects.emplace_back(std::move(cell));
+        }
+    for (int k = 0; k < 8; ++k)
+        table.update(k, columns, CellWithFormula({0, 0},
+                                                 {rows - 1, columns - 1},
+                                                 operations[k % 3]));
+    double checksum = 0.;
+    Clock::time_point start = Clock::now();
+    for (int pass = 0; pass < passes; ++pass) {
+        int x = uniform(rows), y = uniform(columns);
+        objects[static_cast<size_t>(x) * columns + y] = CellWithFormula(
+                TableCell(1. + uniform(1000) / 1000.));
+        for (int k = 0; k < 8; ++k) {
+            double sum = 0., product = 1.;
+            bool valid = true;
+            for (size_t cell = 0; cell < objects.size() && valid; ++cell) {
+                valid = types[cell] == DATA &&
+                        objects[cell].getDataType() != 's';
+                sum += objects[cell].getNumberData();
+                product *= objects[cell].getNumberData();
+            }
+            char operation = operations[k % 3];
+            double result = !valid ? 0. : operation == '+' ? sum :
+                            operation == '*' ? product : sum / objects.size();
+            checksum += std::isfinite(result) ? result : 0.;
+        }
+    }
+    double objectTime = std::chrono::duration<double, std::milli>(
+            Clock::now() - start).count();
+    start = Clock::now();
+    for (int pass = 0; pass < passes; ++pass) {
+        int x = uniform(rows), y = uniform(columns);
+        table.update(x, y, TableCell(1. + uniform(1000) / 1000.));
+        for (int k = 0; k < 8; ++k)
+            if (std::isfinite(table.getCellData(k, columns)))
+                checksum += table.getCellData(k, columns);
+    }
+    double blockTime = std::chrono::duration<double, std::milli>(
+            Clock::now() - start).count();
+    output << "layout: " << rows << "x" << columns << ", 8 whole-sheet "
+           << "formulas, cell objects " << objectTime / passes
+           << " ms/update, column blocks " << blockTime / passes
+           << " ms/update (checksum " << checksum << ")\n";
+}
+
+#ifdef TABLE_COROUTINES
+UpdatePipeline::UpdatePipeline(Table& table): table(table) {
+    table.publish();
+    stage = std::thread(&UpdatePipeline::work, this);
+}
+
+UpdatePipeline::~UpdatePipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    stage.join();
+}
+
+uint64_t UpdatePipeline::update(int row, int column, TableCell cell) {
+    return enqueue(row, column, Pending(std::move(cell)));
+}
+
+uint64_t UpdatePipeline::update(int row, int column, CellWithFormula cell) {
+    return enqueue(row, column, Pending(std::move(cell)));
+}
+
+// A write to a cell that is still queued replaces the earlier one; only the
+// last value matters once the batch commits.
+uint64_t UpdatePipeline::enqueue(int row, int column, Pending&& cell) {
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [slot, inserted] = pending.insert_or_assign({row, column},
+                                                         std::move(cell));
+        merged += !inserted;
+        sequence = ++queued;
+    }
+    wake.notify_one();
+    return sequence;
+}
+
+UpdatePipeline::Read UpdatePipeline::read(int row, int column) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return Read(*this, row, column, queued);
+}
+
+uint64_t UpdatePipeline::coalesced() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return merged;
+}
+
+// Everything queued since the last pass goes in as one batch, so a burst of
+// writes costs a single recalculation and a single published snapshot.
+void UpdatePipeline::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+            return;
+        std::map<std::pair<int, int>, Pending> batch;
+        batch.swap(pending);
+        uint64_t target = queued;
+        lock.unlock();
+        table.beginBatch();
+        for (auto& [position, cell] : batch)
+            std::visit([&](auto& value) {
+                table.update(position.first, position.second,
+                             std::move(value));
+            }, cell);
+        table.commitBatch();
+        table.publish();
+        lock.lock();
+        applied = target;
+        std::vector<std::coroutine_handle<>> ready;
+        auto waiting = std::partition(waiters.begin(), waiters.end(),
+                                      [target](const auto& waiter) {
+                                          return waiter.first > target;
+                                      });
+        for (auto it = waiting; it != waiters.end(); ++it)
+            ready.push_back(it->second);
+        waiters.erase(waiting, waiters.end());
+        lock.unlock();
+        for (auto handle : ready)
+            handle.resume();
+        lock.lock();
+    }
+}
+
+UpdatePipeline::Read::Read(UpdatePipeline& pipeline, int row, int column,
+                           uint64_t target): pipeline(pipeline), row(row),
+column(column), target(target) {}
+
+bool UpdatePipeline::Read::await_ready() const noexcept {
+    return pipeline.applied >= target;
+}
+
+bool UpdatePipeline::Read::await_suspend(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    if (pipeline.applied >= target)
+        return false;
+    pipeline.waiters.emplace_back(target, handle);
+    return true;
+}
+
+double UpdatePipeline::Read::await_resume() const {
+    return pipeline.table.snapshot()->getCellData(row, column);
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        Workload workload;
+        if (!parseWorkload(argc - 2, argv + 2, workload)) {
+            std::cerr << "usage: " << argv[0] << " --bench [rows=N] "
+                      << "[columns=N] [formulas=F] [height=N] [width=N] "
+                      << "[overlap=F] [reads=F] [operations=N] [threads=N] "
+                      << "[seed=N]\n";
+            return 1;
+        }
+        benchmark(workload, std::cout);
+        return 0;
+    }
     TableCell ex_1;
     assert(ex_1.getTextData().empty() && ex_1.getNumberData() == 0. &&
            ex_1.getDataType() == 'E');
@@ -537,6 +3248,501 @@ int main() {
     tab_4.print(2, 0);
     tab_4.print(2, 1);
     tab_4.print(2, 2);
+    assert(tab_4.getCellType(2, 0) == '-' && tab_4.getCellType(2, 1) == '-' &&
+           tab_4.getCellType(2, 2) == '-');
+    tab_4.update(1, 0, cell_3);
+    assert(tab_4.getCellData(2, 0) == 2.73 && tab_4.getCellType(2, 0) == '+' &&
+           tab_4.getCellData(2, 1) == -10.35 &&
+           tab_4.getCellType(2, 1) == '+' &&
+           tab_4.getCellData(2, 2) == 0.6825 &&
+           tab_4.getCellType(2, 2) == '+');
+    tab_4.update(2, 1, cell_2);
+    tab_4.update(0, 0, cell_2);
+    assert(tab_4.getCellData(2, 0) == -0.27 && tab_4.getCellType(2, 1) == 'd' &&
+           tab_4.getCellData(2, 1) == 2.);
+    std::pair<int, int> start_4{2, 0};
+    std::pair<int, int> end_4{2, 2};
+    CellWithFormula f_4(start_4, end_4, '+');
+    tab_4.update(2, 1, f_2);
+    tab_4.update(3, 0, f_4);
+    assert(tab_4.getCellType(3, 0) == '+' &&
+           tab_4.getCellData(3, 0) == tab_4.getCellData(2, 0) +
+           tab_4.getCellData(2, 1) + tab_4.getCellData(2, 2));
+    tab_4.update(0, 1, cell_3);
+    assert(tab_4.getCellType(3, 0) == '+' &&
+           tab_4.getCellData(3, 0) == tab_4.getCellData(2, 0) +
+           tab_4.getCellData(2, 1) + tab_4.getCellData(2, 2));
+    std::pair<int, int> start_5{3, 0};
+    std::pair<int, int> end_5{3, 0};
+    CellWithFormula f_5(start_5, end_5, '~');
+    tab_4.update(1, 1, f_5);
+    assert(tab_4.getCellType(1, 1) == 'c' && tab_4.getCellType(2, 0) == 'c' &&
+           tab_4.getCellType(3, 0) == 'c');
+    tab_4.print(3, 0);
+    tab_4.update(1, 1, cell_4);
+    assert(tab_4.getCellType(2, 0) == '+' && tab_4.getCellType(3, 0) == '+');
+    std::array<double, BLOCKSIZE> values{};
+    std::array<CellTag, BLOCKSIZE> tags{};
+    for (int k = 0; k < BLOCKSIZE; ++k) {
+        values[k] = 1. + k * 0.37;
+        tags[k] = k % 3 ? NUMERIC : RESULT;
+    }
+    std::vector<AggregateKernel> kernels{selectKernel()};
+#ifdef TABLE_SIMD_X86
+    kernels.push_back(aggregateSse2);
+#endif
+    for (int count = 0; count <= BLOCKSIZE; ++count)
+        for (AggregateKernel kernel : kernels) {
+            double sum_1 = 0., prod_1 = 1., sum_2 = 0., prod_2 = 1.;
+            assert(aggregateScalar(values.data(), tags.data(), count,
+                                   sum_1, prod_1) &&
+                   kernel(values.data(), tags.data(), count, sum_2, prod_2) &&
+                   sum_1 == sum_2 && prod_1 == prod_2);
+        }
+    tags[BLOCKSIZE - 1] = TEXTUAL;
+    double sum_3 = 0., prod_3 = 1.;
+    assert(!selectKernel()(values.data(), tags.data(), BLOCKSIZE, sum_3,
+                           prod_3));
+    Table tab_7;
+    tab_7.setPrefixIndex(true);
+    for (int k = 0; k < 40; ++k)
+        for (int l = 0; l < 40; ++l) {
+            TableCell value(static_cast<double>(k + l));
+            tab_7.update(k, l, value);
+        }
+    std::pair<int, int> start_8{3, 5};
+    std::pair<int, int> end_8{36, 38};
+    CellWithFormula f_8(start_8, end_8, '+');
+    CellWithFormula f_9(start_8, end_8, '~');
+    tab_7.update(50, 0, f_8);
+    tab_7.update(50, 1, f_9);
+    assert(tab_7.getCellData(50, 0) == 47396. &&
+           tab_7.getCellData(50, 1) == 41.);
+    tab_7.update(20, 20, cell_2);
+    assert(tab_7.getCellData(50, 0) == 47358. &&
+           tab_7.getCellType(50, 1) == '+');
+    tab_7.update(20, 21, ex_3);
+    assert(tab_7.getCellType(50, 0) == '-' && tab_7.getCellType(50, 1) == '-');
+    tab_7.update(20, 21, f_8);
+    assert(tab_7.getCellType(50, 0) == 'c');
+    tab_7.update(20, 21, cell_2);
+    tab_7.setPrefixIndex(false);
+    tab_7.update(20, 22, cell_2);
+    assert(tab_7.getCellData(50, 0) == 47279.);
+    Table tab_8;
+    std::pair<int, int> start_9{0, 0};
+    std::pair<int, int> end_9{99, 0};
+    CellWithFormula f_10(start_9, end_9, '+');
+    tab_8.update(0, 1, f_10);
+    std::vector<std::pair<std::pair<int, int>, TableCell>> column_1;
+    for (int k = 0; k < 100; ++k)
+        column_1.emplace_back(std::make_pair(k, 0),
+                              TableCell(static_cast<double>(k)));
+    tab_8.update(column_1);
+    assert(tab_8.getCellType(0, 1) == '+' && tab_8.getCellData(0, 1) == 4950.);
+    tab_8.beginBatch();
+    tab_8.update(5, 0, cell_2);
+    tab_8.update(1, 1, f_10);
+    tab_8.beginBatch();
+    tab_8.update(6, 0, ex_3);
+    tab_8.commitBatch();
+    assert(tab_8.getCellData(0, 1) == 4950. && tab_8.getCellType(1, 1) == '-');
+    tab_8.commitBatch();
+    assert(tab_8.getCellType(0, 1) == '-' && tab_8.getCellType(1, 1) == '-');
+    tab_8.update(6, 0, cell_2);
+    assert(tab_8.getCellData(0, 1) == 4943. &&
+           tab_8.getCellData(1, 1) == 4943.);
+    Table tab_9, tab_10;
+    tab_10.setThreads(4);
+    for (Table* table : {&tab_9, &tab_10}) {
+        table->beginBatch();
+        for (int k = 0; k < 200; ++k)
+            for (int l = 0; l < 160; ++l) {
+                TableCell value(1. / (k + l + 1));
+                table->update(k, l, value);
+            }
+        for (int k = 0; k < 12; ++k) {
+            std::pair<int, int> start{k, k};
+            std::pair<int, int> end{199 - k, 159 - k};
+            CellWithFormula formula(start, end, "+*~<>#^|"[k % 8]);
+            table->update(300, k, formula);
+        }
+        std::pair<int, int> start{300, 0};
+        std::pair<int, int> end{300, 11};
+        CellWithFormula total(start, end, '+');
+        table->update(301, 0, total);
+        table->commitBatch();
+        table->update(100, 100, cell_2);
+        table->update(0, 0, cell_4);
+    }
+    for (int k = 0; k < 12; ++k)
+        assert(tab_9.getCellType(300, k) == '+' &&
+               tab_9.getCellData(300, k) == tab_10.getCellData(300, k));
+    assert(tab_9.getCellData(301, 0) == tab_10.getCellData(301, 0));
+    Table tab_11;
+    tab_11.setLazy(true);
+    for (int k = 0; k < 10; ++k) {
+        TableCell value(static_cast<double>(k));
+        tab_11.update(k, 0, value);
+    }
+    std::pair<int, int> start_10{0, 0};
+    std::pair<int, int> end_10{9, 0};
+    std::pair<int, int> start_11{0, 1};
+    std::pair<int, int> end_11{1, 1};
+    CellWithFormula f_11(start_10, end_10, '+');
+    CellWithFormula f_12(start_10, end_10, '~');
+    CellWithFormula f_13(start_11, end_11, '*');
+    tab_11.update(0, 1, f_11);
+    tab_11.update(1, 1, f_12);
+    tab_11.update(0, 2, f_13);
+    assert(tab_11.getCellData(0, 2) == 45. * 4.5 &&
+           tab_11.getCellType(0, 1) == '+' && tab_11.getCellType(1, 1) == '+');
+    tab_11.update(9, 0, cell_2);
+    tab_11.update(8, 0, cell_2);
+    assert(tab_11.getCellData(1, 1) == 3.2 &&
+           tab_11.getCellData(0, 2) == 32. * 3.2);
+    tab_11.update(5, 0, f_11);
+    assert(tab_11.getCellType(0, 2) == 'c' && tab_11.getCellType(0, 1) == 'c');
+    tab_11.update(5, 0, ex_3);
+    tab_11.setLazy(false);
+    assert(tab_11.getCellType(0, 1) == '-' && tab_11.getCellType(0, 2) == '-');
+    tab_11.update(5, 0, cell_2);
+    assert(tab_11.getCellData(0, 1) == 29.);
+    tab_4.update(4, 4, ex_3);
+    assert(tab_4.save("table_snapshot.bin"));
+    Table tab_12;
+    assert(tab_12.load("table_snapshot.bin"));
+    std::string image_1;
+    {
+        std::ifstream saved("table_snapshot.bin", std::ios::binary);
+        image_1.assign(std::istreambuf_iterator<char>(saved),
+                       std::istreambuf_iterator<char>());
+    }
+    std::remove("table_snapshot.bin");
+    uint64_t formulas_1, heap_1;
+    std::memcpy(&formulas_1, image_1.data() + 32, sizeof(formulas_1));
+    std::memcpy(&heap_1, image_1.data() + 40, sizeof(heap_1));
+    std::string corrupt_1 = image_1, corrupt_2 = image_1;
+    corrupt_1[48 + 8 + 8192] = static_cast<char>(200);
+    int32_t negative_1 = -1;
+    std::memcpy(&corrupt_2[image_1.size() - heap_1 - 32 * formulas_1],
+                &negative_1, sizeof(negative_1));
+    std::string corrupt_3 = image_1.substr(0, 48) + std::string(4048, '\0');
+    uint64_t wrapping_1 = 1033929606039444730ULL, zero_1 = 0;
+    std::memcpy(&corrupt_3[16], &wrapping_1, sizeof(wrapping_1));
+    for (int k = 24; k < 48; k += 8)
+        std::memcpy(&corrupt_3[k], &zero_1, sizeof(zero_1));
+    for (const std::string& corrupt : {corrupt_1, corrupt_2, corrupt_3}) {
+        std::ofstream("table_corrupt.bin", std::ios::binary) << corrupt;
+        assert(!tab_12.load("table_corrupt.bin"));
+    }
+    std::remove("table_corrupt.bin");
+    for (int k = 0; k < 5; ++k)
+        for (int l = 0; l < 5; ++l)
+            assert(tab_12.getCellType(k, l) == tab_4.getCellType(k, l) &&
+                   tab_12.getCellData(k, l) == tab_4.getCellData(k, l));
+    tab_12.print(4, 4);
+    tab_12.update(0, 0, cell_4);
+    tab_4.update(0, 0, cell_4);
+    assert(tab_12.getCellData(3, 0) == tab_4.getCellData(3, 0) &&
+           tab_12.getCellType(3, 0) == '+');
+    assert(!tab_12.load("missing_snapshot.bin"));
+    std::stringstream csv_1;
+    tab_4.exportCsv(csv_1);
+    Table tab_13;
+    assert(tab_13.importCsv(csv_1));
+    for (int k = 0; k < 5; ++k)
+        for (int l = 0; l < 5; ++l)
+            assert(tab_13.getCellType(k, l) == tab_4.getCellType(k, l) &&
+                   tab_13.getCellData(k, l) == tab_4.getCellData(k, l));
+    std::stringstream csv_2;
+    csv_2 << "1,2.5,\"a \"\"b\"\", c\"\r\n\n,=+R0C0:R0C1,=*R0C0:R0C1\r\n"
+             "=+R9C9,x\n7";
+    Table tab_14;
+    assert(tab_14.importCsv(csv_2, 1, 1));
+    assert(tab_14.getCellData(1, 1) == 1. && tab_14.getCellData(1, 2) == 2.5 &&
+           tab_14.getCellType(1, 3) == 'd' && tab_14.getCellType(2, 1) == '?' &&
+           tab_14.getCellType(3, 1) == '?' && tab_14.getCellType(3, 2) == '-' &&
+           tab_14.getCellType(4, 1) == 'd' && tab_14.getCellData(5, 1) == 7.);
+    tab_14.print(1, 3);
+    tab_14.update(0, 0, cell_2);
+    tab_14.update(0, 1, cell_2);
+    assert(tab_14.getCellData(3, 2) == 4. && tab_14.getCellData(3, 3) == 4.);
+    std::stringstream csv_3;
+    csv_3 << "1,\"open";
+    assert(!tab_14.importCsv(csv_3));
+    std::stringstream csv_6;
+    csv_6 << "=xR0C0:R1C1,=+R-1C0:R1C1,=+R2C0:R1C1,=#R0C0:R1C1\n";
+    assert(tab_14.importCsv(csv_6, 21, 0) &&
+           tab_14.getCellText(21, 0) == "=xR0C0:R1C1" &&
+           tab_14.getCellText(21, 1) == "=+R-1C0:R1C1" &&
+           tab_14.getCellText(21, 2) == "=+R2C0:R1C1" &&
+           tab_14.getCellType(21, 3) == '+');
+    std::stringstream csv_5;
+    csv_5 << "1,\"" << std::string((1 << 16) - 4, 'x') << '"';
+    assert(tab_14.importCsv(csv_5, 20, 0) &&
+           tab_14.getCellText(20, 1).size() == (1 << 16) - 4);
+    StringPool pool_1;
+    uint32_t handle_1 = pool_1.intern("example");
+    uint32_t handle_2 = pool_1.intern(ex_3.getTextView());
+    assert(handle_1 == handle_2 && pool_1.size() == 1 &&
+           pool_1.view(handle_1) == "example");
+    pool_1.release(handle_1);
+    assert(pool_1.size() == 1);
+    pool_1.release(handle_2);
+    assert(pool_1.size() == 0 && pool_1.intern("other") == handle_1);
+    StringPool pool_2(pool_1);
+    pool_2.release(handle_1);
+    uint32_t handle_3 = pool_2.intern("third");
+    assert(handle_3 == handle_1 && pool_2.view(handle_3) == "third" &&
+           pool_1.view(handle_1) == "other" && pool_1.size() == 1 &&
+           pool_1.intern("other") == handle_1);
+    assert(tab_14.getCellText(1, 3) == "a \"b\", c" &&
+           tab_14.getCellText(1, 1).empty() && tab_4.getCellText(9, 9).empty());
+    Table tab_5;
+    tab_5.update(2000000, 40, cell_2);
+    tab_5.update(2000001, 41, cell_3);
+    std::pair<int, int> start_6{1999999, 31};
+    std::pair<int, int> end_6{2000001, 41};
+    CellWithFormula f_6(start_6, end_6, '+');
+    tab_5.update(0, 0, f_6);
+    assert(tab_5.getCellType(0, 0) == '-' &&
+           tab_5.getCellData(2000000, 40) == 2. &&
+           tab_5.getCellType(2000000, 41) == '?' &&
+           tab_5.getCellData(2000000, 41) == 0.);
+    std::pair<int, int> start_7{2000000, 40};
+    std::pair<int, int> end_7{2000001, 40};
+    CellWithFormula f_7(start_7, end_7, '*');
+    tab_5.update(2000002, 40, f_7);
+    tab_5.update(2000001, 40, cell_3);
+    assert(tab_5.getCellType(2000002, 40) == '+' &&
+           tab_5.getCellData(2000002, 40) == -9.);
+    Table tab_6(tab_5);
+    assert(tab_6.getCellData(2000002, 40) == -9. &&
+           tab_6.getCellType(2000001, 41) == 'd');
+    Table tab_27;
+    std::pair<int, int> start_15{0, 0};
+    std::pair<int, int> end_15{1, 0};
+    tab_27.update(0, 0, TableCell(2.));
+    tab_27.update(1, 0, TableCell());
+    tab_27.update(0, 1, CellWithFormula(start_15, end_15, '+'));
+    tab_27.update(1, 1, CellWithFormula(start_15, end_15, '#'));
+    tab_27.update(2, 1, CellWithFormula(start_15, end_15, '~'));
+    assert(tab_27.getCellType(0, 1) == '+' && tab_27.getCellData(0, 1) == 2. &&
+           tab_27.getCellData(1, 1) == 2. && tab_27.getCellData(2, 1) == 1.);
+    tab_27.setPrefixIndex(true);
+    tab_27.update(0, 0, TableCell(4.));
+    assert(tab_27.getCellData(0, 1) == 4. && tab_27.getCellData(2, 1) == 2.);
+    for (int k = 0; k < 40; ++k)
+        tab_27.update(k, 3, k == 17 ? TableCell() : TableCell(1.));
+    tab_27.update(0, 4, CellWithFormula({0, 3}, {39, 3}, '*'));
+    tab_27.update(1, 4, CellWithFormula({0, 3}, {39, 3}, '+'));
+    assert(tab_27.getCellData(0, 4) == 0. && tab_27.getCellData(1, 4) == 39.);
+    tab_27.update(0, 5, CellWithFormula({0, 0}, {200000, 3}, '#'));
+    assert(tab_27.getCellData(0, 5) == 45.);
+    tab_27.update(100000, 2, TableCell(1.));
+    assert(tab_27.getCellData(0, 5) == 46.);
+    static_assert(std::is_nothrow_move_constructible_v<Table> &&
+                  std::is_nothrow_move_assignable_v<Table> &&
+                  std::is_nothrow_move_assignable_v<RecalcStatistics>);
+    Table tab_15(tab_7);
+    TableCell cell_5(std::string("moved"));
+    tab_15.update(3, 5, std::move(cell_5));
+    assert(tab_15.getCellType(50, 0) == '-' &&
+           tab_15.getCellText(3, 5) == "moved" &&
+           tab_7.getCellData(50, 0) == 47279. &&
+           tab_7.getCellText(3, 5).empty());
+    tab_7.update(3, 5, cell_2);
+    assert(tab_7.getCellData(50, 0) == 47273. &&
+           tab_15.getCellType(50, 0) == '-' &&
+           tab_15.getCellData(4, 5) == tab_7.getCellData(4, 5));
+    Table tab_16(std::move(tab_15));
+    tab_6 = tab_16;
+    tab_16.update(3, 5, TableCell(-1.));
+    CellWithFormula t_4(TableCell(std::string("moved")));
+    assert(t_4.getTextData() == "moved" && t_4.getOperationType() == '?' &&
+           tab_6.getCellText(3, 5) == "moved" &&
+           tab_16.getCellType(3, 5) == 'd' &&
+           tab_16.getCellData(50, 0) == tab_7.getCellData(50, 0) - 3.);
+    Table tab_17;
+    std::pair<int, int> start_12{0, 0};
+    std::pair<int, int> end_12{7, 0};
+    CellWithFormula f_14(start_12, end_12, '+');
+    tab_17.update(0, 1, f_14);
+    assert(!tab_17.snapshot() && tab_17.publish());
+    std::atomic<bool> writing{true};
+    std::vector<std::thread> readers;
+    for (int k = 0; k < 4; ++k)
+        readers.emplace_back([&tab_17, &writing] {
+            while (writing) {
+                std::shared_ptr<const Table> view = tab_17.snapshot();
+                double total = 0.;
+                for (int l = 0; l < 8; ++l)
+                    total += view->getCellData(l, 0);
+                assert(view->getCellType(0, 1) != '+' ||
+                       view->getCellData(0, 1) == total);
+            }
+        });
+    for (int k = 0; k < 400; ++k) {
+        tab_17.update(k % 8, 0, TableCell(static_cast<double>(k)));
+        assert(tab_17.publish());
+    }
+    writing = false;
+    for (auto& reader : readers)
+        reader.join();
+    tab_17.beginBatch();
+    assert(!tab_17.publish());
+    tab_17.commitBatch();
+    assert(tab_17.snapshot()->getCellData(0, 1) == 3164.);
+    Table tab_18;
+    for (int k = 0; k < 40; ++k)
+        tab_18.update(k, 0, TableCell(k + 1.));
+    std::pair<int, int> start_13{0, 0};
+    std::pair<int, int> end_13{39, 0};
+    for (int k = 0; k < 8; ++k)
+        tab_18.update(0, k + 1, CellWithFormula(start_13, end_13,
+                                                "+<>#^|~*"[k]));
+    assert(tab_18.getCellData(0, 1) == 820. &&
+           tab_18.getCellData(0, 2) == 1. && tab_18.getCellData(0, 3) == 40. &&
+           tab_18.getCellData(0, 4) == 40. &&
+           tab_18.getCellData(0, 5) == 133.25 &&
+           tab_18.getCellData(0, 6) == std::sqrt(133.25) &&
+           tab_18.getCellData(0, 7) == 20.5);
+    tab_18.update(5, 0, ex_3);
+    assert(tab_18.getCellType(0, 2) == '-' && tab_18.getCellType(0, 5) == '-' &&
+           tab_18.getCellType(0, 4) == '+' && tab_18.getCellData(0, 4) == 39.);
+    std::stringstream csv_4;
+    tab_18.exportCsv(csv_4);
+    Table tab_19;
+    assert(tab_19.importCsv(csv_4) && tab_19.getCellData(0, 4) == 39.);
+    tab_19.update(5, 0, cell_3);
+    assert(tab_19.getCellData(0, 2) == -4.5 && tab_19.getCellData(0, 3) == 40.);
+    tab_18.resetStatistics();
+    tab_18.update(6, 0, cell_2);
+    const RecalcStatistics& stats_1 = tab_18.statistics();
+#if TABLE_STATISTICS
+    assert(stats_1.recalculations == 1 && stats_1.lastFormulas == 8 &&
+           stats_1.lastCells == 40 && stats_1.operationCount.at('#') == 1 &&
+           stats_1.costliest.size() == 8);
+#endif
+    std::stringstream json_1;
+    stats_1.dump(json_1);
+    assert(json_1.str().rfind("{\"recalculations\":", 0) == 0 &&
+           json_1.str().back() == '}');
+    Table tab_20;
+    tab_20.setRangeCache(true);
+    for (int k = 0; k < 10; ++k)
+        tab_20.update(k, 0, TableCell(static_cast<double>(k)));
+    tab_20.update(0, 1, f_11);
+    tab_20.update(1, 1, f_11);
+    assert(tab_20.cacheHits() == 1 && tab_20.cacheMisses() == 1 &&
+           tab_20.getCellData(1, 1) == 45.);
+    tab_20.update(5, 0, cell_2);
+    tab_20.update(20, 20, cell_2);
+    assert(tab_20.getCellData(0, 1) == 42. &&
+           tab_20.getCellData(1, 1) == 42. && tab_20.cacheHits() == 1 &&
+           tab_20.cacheMisses() == 3);
+    tab_20.setLazy(true);
+    tab_20.update(2, 1, f_12);
+    tab_20.update(6, 0, cell_2);
+    assert(tab_20.getCellData(0, 1) == 38. &&
+           tab_20.getCellData(1, 1) == 38. &&
+           tab_20.getCellData(2, 1) == 3.8 && tab_20.cacheHits() == 2 &&
+           tab_20.cacheMisses() == 5);
+    tab_20.update(0, 1, cell_2);
+    tab_20.update(1, 1, cell_2);
+    tab_20.update(2, 1, cell_2);
+    tab_20.update(0, 1, f_11);
+    assert(tab_20.getCellData(0, 1) == 38. && tab_20.cacheHits() == 2 &&
+           tab_20.cacheMisses() == 6);
+    Workload workload_1;
+    char rows_1[] = "rows=64", reads_1[] = "reads=0.5", bad_1[] = "rows";
+    char bad_2[] = "rows=1.5", bad_3[] = "seed=1e12", bad_4[] = "reads=nan";
+    char* options_1[] = {rows_1, reads_1, bad_1};
+    char* options_2[] = {bad_2, bad_3, bad_4};
+    assert(parseWorkload(2, options_1, workload_1) && workload_1.rows == 64 &&
+           workload_1.reads == 0.5 && workload_1.columns == 64 &&
+           !parseWorkload(3, options_1, workload_1));
+    for (int k = 0; k < 3; ++k)
+        assert(!parseWorkload(1, options_2 + k, workload_1));
+    std::remove("table_journal.log");
+    std::remove("table_journal.log.snapshot");
+#ifdef TABLE_COROUTINES
+    Table tab_25;
+    std::pair<int, int> start_14{0, 0};
+    std::pair<int, int> end_14{9, 0};
+    tab_25.update(0, 1, CellWithFormula(start_14, end_14, '+'));
+    std::vector<double> totals(50, -1.);
+    {
+        UpdatePipeline pipeline_1(tab_25);
+        auto handler = [](UpdatePipeline& pipeline, double& total,
+                          int k) -> Detached {
+            for (int l = 0; l < 10; ++l)
+                pipeline.update(l, 0, TableCell(static_cast<double>(k)));
+            total = co_await pipeline.read(0, 1);
+        };
+        for (int k = 0; k < 50; ++k)
+            handler(pipeline_1, totals[k], k);
+    }
+    for (int k = 0; k < 50; ++k)
+        assert(totals[k] >= 10. * k);
+    assert(totals[49] == 490. && tab_25.getCellData(0, 1) == 490.);
+#endif
+    {
+        Table tab_21;
+        assert(tab_21.openJournal("table_journal.log"));
+        tab_21.update(0, 0, cell_3);
+        tab_21.update(1, 0, TableCell(std::string("journal")));
+        tab_21.update(2, 0, ex_1);
+        tab_21.update(5, 5, CellWithFormula(start_1, end_1, '<'));
+        assert(tab_21.syncJournal());
+    }
+    Table tab_22;
+    assert(tab_22.openJournal("table_journal.log", 3) &&
+           tab_22.getCellData(0, 0) == -4.5 &&
+           tab_22.getCellText(1, 0) == "journal" &&
+           tab_22.getCellType(2, 0) == 'd' && tab_22.getCellType(5, 5) == '-');
+    tab_22.update(1, 0, cell_2);
+    tab_22.update(1, 1, cell_2);
+    tab_22.update(0, 0, cell_2);
+    tab_22.update(0, 1, cell_4);
+    assert(tab_22.getCellData(5, 5) == 0.23 && tab_22.syncJournal());
+    {
+        std::ofstream torn("table_journal.log", std::ios::binary |
+                                                std::ios::app);
+        torn.write("\x11\0\0\0torn", 8);
+    }
+    Table tab_23;
+    assert(tab_23.openJournal("table_journal.log") &&
+           tab_23.getCellData(5, 5) == 0.23 && tab_23.getCellData(0, 0) == 2. &&
+           tab_23.getCellText(1, 0).empty());
+    tab_23.update(4, 4, cell_3);
+    assert(tab_23.checkpoint());
+    tab_23.update(4, 4, cell_4);
+    assert(tab_23.syncJournal());
+    Table tab_24;
+    assert(tab_24.openJournal("table_journal.log") &&
+           tab_24.getCellData(4, 4) == 0.23 &&
+           tab_24.getCellData(5, 5) == 0.23);
+    tab_24.update(6, 6, cell_3);
+    tab_24 = tab_4;
+    assert(tab_24.getCellData(6, 6) == -4.5);
+    tab_4.beginBatch();
+    assert(!tab_24.replaceWith(tab_4) && tab_24.getCellData(6, 6) == -4.5);
+    tab_4.commitBatch();
+    std::filesystem::create_directory("table_journal.log.snapshot.tmp");
+    assert(!tab_24.replaceWith(tab_4) && tab_24.getCellData(6, 6) == -4.5);
+    std::filesystem::remove("table_journal.log.snapshot.tmp");
+    assert(tab_24.replaceWith(tab_4));
+    tab_24.update(6, 6, cell_2);
+    assert(tab_24.syncJournal());
+    Table tab_26;
+    assert(tab_26.openJournal("table_journal.log") &&
+           tab_26.getCellData(6, 6) == 2. &&
+           tab_26.getCellData(2, 2) == tab_4.getCellData(2, 2) &&
+           tab_26.getCellType(4, 4) == tab_4.getCellType(4, 4));
+    std::remove("table_journal.log");
+    std::remove("table_journal.log.snapshot");
     assert(tab_4.cellType() == "Table of cells");
     std::cout << "All tests have successfully passed";
     return 0;